@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -28,15 +28,19 @@ SOURCES += main.cpp\
     finddialog.cpp \
     gotocelldialog.cpp \
     spreadsheet.cpp \
-    cell.cpp \
-    sortdialog.cpp
+    sortdialog.cpp \
+    spreadsheetmodel.cpp \
+    profilerpanel.cpp
 
 HEADERS  += mainwindow.h \
     finddialog.h \
     gotocelldialog.h \
     spreadsheet.h \
-    cell.h \
-    sortdialog.h
+    sortdialog.h \
+    spreadsheetmodel.h \
+    profilerpanel.h
+
+include(engine.pri)
 
 RESOURCES += \
     resource.qrc
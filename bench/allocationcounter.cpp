@@ -0,0 +1,86 @@
+#include "allocationcounter.h"
+
+#include <atomic>
+
+#include <stdlib.h>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+// The counter is constant-initialized, so it can be bumped by
+// allocations made before main() as well.
+static std::atomic<quint64> allocations(0);
+
+#if defined(__GLIBC__)
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+}
+
+bool AllocationCounter::isAvailable()
+{
+    return true;
+}
+
+#else
+
+bool AllocationCounter::isAvailable()
+{
+    return false;
+}
+
+#endif
+
+quint64 AllocationCounter::count()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// The second field of /proc/self/statm is the resident size in pages.
+qint64 AllocationCounter::residentKb()
+{
+#if defined(Q_OS_LINUX)
+    int fd = ::open("/proc/self/statm", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    char text[128];
+    ssize_t length = ::read(fd, text, sizeof(text) - 1);
+    ::close(fd);
+    if (length <= 0)
+        return -1;
+    text[length] = '\0';
+
+    long long size;
+    long long resident;
+    if (sscanf(text, "%lld %lld", &size, &resident) != 2)
+        return -1;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,19 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+// Counts the heap allocations of the whole process by standing in for
+// malloc(), calloc() and realloc().  This only works against glibc;
+// elsewhere isAvailable() is false and the count stays at zero.
+class AllocationCounter
+{
+public:
+    static bool isAvailable();
+    static quint64 count();
+    // The current resident set size of the process in kilobytes, or
+    // -1 where it is not known.  Reading it allocates nothing.
+    static qint64 residentKb();
+};
+
+#endif // ALLOCATIONCOUNTER_H
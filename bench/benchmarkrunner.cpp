@@ -0,0 +1,74 @@
+#include "benchmarkrunner.h"
+#include "allocationcounter.h"
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QVector>
+
+#include <algorithm>
+
+BenchmarkRunner::BenchmarkRunner(int repeat, const QString &filter)
+    : repeat(qMax(1, repeat)), filter(filter)
+{
+}
+
+bool BenchmarkRunner::isSelected(const QString &name) const
+{
+    return filter.pattern().isEmpty() || filter.match(name).hasMatch();
+}
+
+void BenchmarkRunner::run(const QString &name, const QString &workload,
+                          qint64 cells, int threads,
+                          const std::function<void()> &setup,
+                          const std::function<void()> &body)
+{
+    QString fullName = name + '/' + workload;
+    if (!isSelected(fullName))
+        return;
+
+    QVector<double> samples;
+    QVector<quint64> allocations;
+    QElapsedTimer timer;
+    qint64 residentBefore = AllocationCounter::residentKb();
+    qint64 residentAfter = residentBefore;
+    qint64 residentGrowth = 0;
+    for (int i = 0; i < repeat; ++i) {
+        if (setup)
+            setup();
+        qint64 resident = AllocationCounter::residentKb();
+        quint64 before = AllocationCounter::count();
+        timer.start();
+        body();
+        samples.append(timer.nsecsElapsed() / 1e6);
+        allocations.append(AllocationCounter::count() - before);
+        residentAfter = AllocationCounter::residentKb();
+        residentGrowth = qMax(residentGrowth, residentAfter - resident);
+    }
+    std::sort(samples.begin(), samples.end());
+    std::sort(allocations.begin(), allocations.end());
+
+    QJsonObject result;
+    result.insert("benchmark", name);
+    result.insert("workload", workload);
+    result.insert("cells", double(cells));
+    result.insert("threads", threads);
+    result.insert("repeat", repeat);
+    result.insert("min_ms", samples.first());
+    result.insert("median_ms", samples[samples.size() / 2]);
+    if (AllocationCounter::isAvailable())
+        result.insert("allocations",
+                      double(allocations[allocations.size() / 2]));
+    // Resident memory of the process before the first setup and after
+    // the last run, and the most any one body added to it.
+    if (residentBefore >= 0) {
+        result.insert("rss_before_kb", double(residentBefore));
+        result.insert("rss_after_kb", double(residentAfter));
+        result.insert("rss_growth_kb", double(residentGrowth));
+    }
+    resultList.append(result);
+
+    // Progress goes to stderr so that stdout stays machine-readable.
+    QTextStream err(stderr);
+    err << fullName << ": " << samples[samples.size() / 2] << " ms\n";
+}
@@ -0,0 +1,33 @@
+#ifndef BENCHMARKRUNNER_H
+#define BENCHMARKRUNNER_H
+
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <QString>
+
+#include <functional>
+
+// Times benchmark bodies and collects the results.  Each run gets a
+// fresh setup that is not timed; the reported figures are the minimum
+// and median of the repetitions, in milliseconds, the median count of
+// heap allocations made by the body where they can be counted, and the
+// resident memory of the process around the runs.
+class BenchmarkRunner
+{
+public:
+    BenchmarkRunner(int repeat, const QString &filter);
+
+    bool isSelected(const QString &name) const;
+    void run(const QString &name, const QString &workload, qint64 cells,
+             int threads, const std::function<void()> &setup,
+             const std::function<void()> &body);
+
+    QJsonArray results() const { return resultList; }
+
+private:
+    int repeat;
+    QRegularExpression filter;
+    QJsonArray resultList;
+};
+
+#endif // BENCHMARKRUNNER_H
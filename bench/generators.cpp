@@ -0,0 +1,142 @@
+#include "generators.h"
+#include "sheet.h"
+
+quint32 Generators::seed = 1;
+
+// A linear congruential generator is plenty here and keeps the data
+// identical across platforms and Qt versions.
+double Generators::number()
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % 100000 / 100.0;
+}
+
+QString Generators::word()
+{
+    static const char * const syllables[] = {
+        "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "ze", "qua",
+        "bri", "dan", "fel", "gor", "hap", "jin"
+    };
+
+    QString result;
+    int length = 1 + int(number()) % 4;
+    for (int i = 0; i < length; ++i)
+        result += syllables[int(number() * 100) % 16];
+    return result;
+}
+
+void Generators::denseGrid(Sheet *sheet, int rows, int columns)
+{
+    seed = 1;
+    int numeric = qMax(3, columns - 2);
+    QString last = CellReference::columnName(numeric - 1);
+
+    sheet->beginBatch();
+    for (int row = 0; row < rows; ++row) {
+        QString n = QString::number(row + 1);
+        for (int column = 0; column < numeric; ++column)
+            sheet->setFormula(row, column, QString::number(number()));
+        sheet->setFormula(row, numeric, "=A" + n + "*B" + n + "+C" + n);
+        sheet->setFormula(row, numeric + 1,
+                          "=SUM(A" + n + ":" + last + n + ")");
+    }
+    sheet->commitBatch();
+}
+
+void Generators::chain(Sheet *sheet, int length)
+{
+    sheet->beginBatch();
+    sheet->setFormula(0, 0, "1");
+    for (int row = 1; row < length; ++row)
+        sheet->setFormula(row, 0, "=A" + QString::number(row) + "+1");
+    sheet->commitBatch();
+}
+
+void Generators::fanOut(Sheet *sheet, int width)
+{
+    sheet->beginBatch();
+    sheet->setFormula(0, 0, "2");
+    for (int row = 0; row < width; ++row)
+        sheet->setFormula(row, 1, "=A1*" + QString::number(row + 1));
+    sheet->commitBatch();
+}
+
+void Generators::fanIn(Sheet *sheet, int width)
+{
+    seed = 2;
+    enum { Window = 100 };
+
+    sheet->beginBatch();
+    for (int row = 0; row < width; ++row)
+        sheet->setFormula(row, 0, QString::number(number()));
+    for (int row = 0; row < width; ++row) {
+        int last = qMin(row + Window, width);
+        sheet->setFormula(row, 1, "=SUM(A" + QString::number(row + 1) + ":A"
+                          + QString::number(last) + ")");
+    }
+    sheet->commitBatch();
+}
+
+void Generators::strings(Sheet *sheet, int rows, int columns)
+{
+    seed = 3;
+    sheet->beginBatch();
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column)
+            sheet->setFormula(row, column, word() + ' ' + word());
+    }
+    sheet->commitBatch();
+}
+
+void Generators::columnSum(Sheet *sheet, int rows)
+{
+    seed = 4;
+    QString range = "(A1:A" + QString::number(rows) + ")";
+
+    sheet->beginBatch();
+    for (int row = 0; row < rows; ++row)
+        sheet->setFormula(row, 0, QString::number(number()));
+    sheet->setFormula(0, 1, "=SUM" + range);
+    sheet->setFormula(1, 1, "=AVERAGE" + range);
+    sheet->setFormula(2, 1, "=MIN" + range);
+    sheet->setFormula(3, 1, "=MAX" + range);
+    sheet->setFormula(4, 1, "=COUNT" + range);
+    sheet->commitBatch();
+}
+
+void Generators::lookupJoin(Sheet *sheet, int rows)
+{
+    seed = 6;
+    QString last = QString::number(rows);
+
+    sheet->beginBatch();
+    for (int row = 0; row < rows; ++row) {
+        QString n = QString::number(row + 1);
+        sheet->setFormula(row, 0, QString::number(qint64(row) * 7919 % rows));
+        sheet->setFormula(row, 1, QString::number(number()));
+        sheet->setFormula(row, 2,
+                          QString::number(qint64(row) * 104729 % rows));
+        if (row % 2) {
+            sheet->setFormula(row, 3, "=XLOOKUP(C" + n + ",A1:A" + last
+                              + ",B1:B" + last + ")");
+        } else {
+            sheet->setFormula(row, 3, "=VLOOKUP(C" + n + ",A1:B" + last
+                              + ",2,0)");
+        }
+    }
+    sheet->commitBatch();
+}
+
+QStringList Generators::pasteBlock(int rows, int columns)
+{
+    seed = 5;
+    QStringList lines;
+    for (int row = 0; row < rows; ++row) {
+        QStringList fields;
+        for (int column = 0; column + 1 < columns; ++column)
+            fields.append(QString::number(number()));
+        fields.append("=A" + QString::number(row + 1) + "*2");
+        lines.append(fields.join('\t'));
+    }
+    return lines;
+}
@@ -0,0 +1,43 @@
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include <QString>
+#include <QStringList>
+
+class Sheet;
+
+// Fills sheets with synthetic workloads.  The data comes from a fixed
+// seed, so every run of a benchmark works on the same sheet.
+class Generators
+{
+public:
+    // Numeric columns followed by an arithmetic and a SUM column.
+    static void denseGrid(Sheet *sheet, int rows, int columns);
+    // A1 = 1, then each cell of column A adds one to the one above.
+    static void chain(Sheet *sheet, int length);
+    // A single cell with `width` dependents in column B.
+    static void fanOut(Sheet *sheet, int width);
+    // `width` numbers in column A summed by ranges in column B, each
+    // range overlapping the next.
+    static void fanIn(Sheet *sheet, int width);
+    // Words of a few syllables, a fair share of them repeated.
+    static void strings(Sheet *sheet, int rows, int columns);
+    // A column of numbers and aggregates over all of it.
+    static void columnSum(Sheet *sheet, int rows);
+    // A table of shuffled keys and values in columns A and B, joined
+    // by as many exact lookups in column D, alternately VLOOKUP and
+    // XLOOKUP.
+    static void lookupJoin(Sheet *sheet, int rows);
+
+    // A block of tab-separated numbers and formulas, as the clipboard
+    // would hold it for a paste.
+    static QStringList pasteBlock(int rows, int columns);
+
+private:
+    static double number();
+    static QString word();
+
+    static quint32 seed;
+};
+
+#endif // GENERATORS_H
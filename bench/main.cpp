@@ -0,0 +1,440 @@
+#include "benchmarkrunner.h"
+#include "csvfile.h"
+#include "generators.h"
+#include "referenceevaluator.h"
+#include "rowsorter.h"
+#include "searchindex.h"
+#include "sheet.h"
+#include "sheetfile.h"
+#include "undojournal.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+
+namespace {
+
+struct Sizes
+{
+    int denseRows;
+    int chainLength;
+    int fanWidth;
+    int sumRows;
+    int stringRows;
+    int pasteRows;
+    int lookupRows;
+};
+
+Sheet *newSheet(int threads)
+{
+    Sheet *sheet = new Sheet;
+    sheet->setThreadCount(threads);
+    sheet->setAutoRecalculate(false);
+    return sheet;
+}
+
+// Returns false when a recalculation gives a wrong result.
+bool recalculationBenchmarks(BenchmarkRunner *runner, const Sizes &sizes,
+                             int threads)
+{
+    bool ok = true;
+    struct Workload
+    {
+        const char *name;
+        void (*generate)(Sheet *, int);
+        int size;
+    };
+    const Workload workloads[] = {
+        { "chain", Generators::chain, sizes.chainLength },
+        { "fanout", Generators::fanOut, sizes.fanWidth },
+        { "fanin", Generators::fanIn, sizes.fanWidth },
+        { "sum", Generators::columnSum, sizes.sumRows },
+        { "lookup", Generators::lookupJoin, sizes.lookupRows }
+    };
+
+    for (const Workload &workload : workloads) {
+        if (!runner->isSelected(QString("recalculate/") + workload.name))
+            continue;
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        workload.generate(sheet.data(), workload.size);
+        runner->run("recalculate", workload.name, sheet->cells().count(),
+                    threads, 0, [&]() { sheet->recalculate(); });
+
+        // The end of the chain holds its length, and only gets there
+        // if every link was evaluated, without running out of stack.
+        if (workload.generate == Generators::chain
+                && sheet->value(workload.size - 1, 0)
+                   != Value::fromNumber(workload.size)) {
+            QTextStream(stderr) << "recalculate/chain: wrong result at row "
+                                << workload.size << '\n';
+            ok = false;
+        }
+    }
+
+    // The dense grid is also run with 1, 2, 4... threads to show how
+    // the level-parallel evaluation scales.
+    if (runner->isSelected("recalculate/dense")) {
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        Generators::denseGrid(sheet.data(), sizes.denseRows, 12);
+        for (int n = 1; ; n = qMin(2 * n, threads)) {
+            sheet->setThreadCount(n);
+            runner->run("recalculate", "dense", sheet->cells().count(), n,
+                        0, [&]() { sheet->recalculate(); });
+            if (n == threads)
+                break;
+        }
+    }
+
+    // The recursive QVariant evaluator would overflow the stack on the
+    // long chain, so both evaluators are compared on a short one.
+    enum { ShortChain = 2000 };
+    if (runner->isSelected("recalculate/chain-short")
+            || runner->isSelected("recalculate-reference/chain-short")) {
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        Generators::chain(sheet.data(), ShortChain);
+        runner->run("recalculate", "chain-short", ShortChain, threads, 0,
+                    [&]() { sheet->recalculate(); });
+
+        ReferenceEvaluator reference(*sheet);
+        runner->run("recalculate-reference", "chain-short", ShortChain, 1,
+                    0, [&]() { reference.recalculate(); });
+    }
+
+    if (runner->isSelected("recalculate-reference/fanout")) {
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        Generators::fanOut(sheet.data(), sizes.fanWidth);
+        ReferenceEvaluator reference(*sheet);
+        runner->run("recalculate-reference", "fanout", sizes.fanWidth, 1,
+                    0, [&]() { reference.recalculate(); });
+    }
+
+    // What the status bar does for a selection of the whole column.
+    if (runner->isSelected("summarize/column")) {
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        Generators::columnSum(sheet.data(), sizes.sumRows);
+        CellRange column = { 0, 0, Sheet::RowCount - 1, 0 };
+        runner->run("summarize", "column", sizes.sumRows, 1, 0,
+                    [&]() { sheet->cells().summarize(column); });
+    }
+    return ok;
+}
+
+void editBenchmarks(BenchmarkRunner *runner, const Sizes &sizes,
+                    int threads)
+{
+    if (runner->isSelected("edit/fanout")) {
+        QScopedPointer<Sheet> sheet(newSheet(threads));
+        Generators::fanOut(sheet.data(), sizes.fanWidth);
+        sheet->setAutoRecalculate(true);
+        int n = 0;
+        runner->run("edit", "fanout", sheet->cells().count(), threads, 0,
+                    [&]() { sheet->setFormula(0, 0, QString::number(++n)); });
+    }
+
+    if (runner->isSelected("paste/dense")
+            || runner->isSelected("undo/paste")) {
+        QStringList lines = Generators::pasteBlock(sizes.pasteRows, 10);
+        QScopedPointer<Sheet> sheet;
+        UndoJournal journal;
+        auto newPasteSheet = [&]() {
+            sheet.reset(newSheet(threads));
+            sheet->setAutoRecalculate(true);
+            journal.clear();
+        };
+        // Records the paste for undo the way the GUI does.
+        auto paste = [&]() {
+            sheet->beginBatch();
+            journal.beginGroup();
+            for (int i = 0; i < lines.size(); ++i) {
+                QStringList fields = lines[i].split('\t');
+                for (int j = 0; j < fields.size(); ++j) {
+                    journal.record(*sheet, i, j);
+                    sheet->setFormula(i, j, fields[j]);
+                }
+            }
+            journal.endGroup(*sheet, "Paste");
+            sheet->commitBatch();
+        };
+
+        qint64 cells = qint64(sizes.pasteRows) * 10;
+        runner->run("paste", "dense", cells, threads, newPasteSheet, paste);
+        runner->run("undo", "paste", cells, threads,
+                    [&]() { newPasteSheet(); paste(); },
+                    [&]() { journal.undo(sheet.data()); });
+    }
+
+    if (runner->isSelected("fill/column")) {
+        QScopedPointer<Sheet> sheet;
+        CellRange range = { 0, 1, sizes.sumRows - 1, 1 };
+        runner->run("fill", "column", sizes.sumRows, threads,
+                    [&]() { sheet.reset(newSheet(threads));
+                            sheet->setFormula(0, 1, "=A1*2+SUM(A1:A10)"); },
+                    [&]() { sheet->fillDown(range); });
+    }
+
+    if (runner->isSelected("delete/dense")) {
+        QScopedPointer<Sheet> sheet;
+        CellRange range = { 0, 0, sizes.denseRows - 1, 11 };
+        runner->run("delete", "dense", qint64(sizes.denseRows) * 12, threads,
+                    [&]() { sheet.reset(newSheet(threads));
+                            Generators::denseGrid(sheet.data(),
+                                                  sizes.denseRows, 12); },
+                    [&]() { sheet->removeRange(range); });
+    }
+
+    // Sorting as the GUI does: the rows are ordered and then moved,
+    // which rewrites the formulas of every moved row.  Each run starts
+    // from an unsorted sheet.
+    if (runner->isSelected("sort/dense")) {
+        QScopedPointer<Sheet> sheet;
+        CellRange range = { 0, 0, sizes.denseRows - 1, 11 };
+        QVector<RowSorter::Key> keys;
+        RowSorter::Key first = { 1, true };
+        RowSorter::Key second = { 10, false };
+        RowSorter::Key third = { 11, true };
+        keys << first << second << third;
+        runner->run("sort", "dense", qint64(sizes.denseRows) * 12, threads,
+                    [&]() { sheet.reset(newSheet(threads));
+                            Generators::denseGrid(sheet.data(),
+                                                  sizes.denseRows, 12);
+                            sheet->recalculate(); },
+                    [&]() {
+            QVector<int> order = RowSorter::sort(sheet.data(), range, keys);
+            sheet->permuteRows(range, order);
+        });
+    }
+}
+
+// Stops a read once its preview is in, which times the first paint of
+// a file being opened.
+class PreviewProgress : public SheetFile::Progress
+{
+public:
+    PreviewProgress() : done(false) {}
+    bool progress(qint64, qint64) { return !done; }
+    void preview(const Sheet &) { done = true; }
+
+    bool done;
+};
+
+bool fileBenchmarkSelected(const BenchmarkRunner *runner,
+                           const QString &workload)
+{
+    const char *const names[] = { "write/", "read/", "load-clear/",
+                                  "read-preview/", "csv-write/",
+                                  "csv-read/" };
+    for (const char *name : names) {
+        if (runner->isSelected(name + workload))
+            return true;
+    }
+    return false;
+}
+
+void fileBenchmarks(BenchmarkRunner *runner, const Sizes &sizes,
+                    int threads)
+{
+    QTemporaryDir dir;
+    QString errorString;
+
+    // The sheets are only generated for the benchmarks that run.
+    QScopedPointer<Sheet> dense(newSheet(threads));
+    if (fileBenchmarkSelected(runner, "dense")
+            || runner->isSelected("append/dense")) {
+        Generators::denseGrid(dense.data(), sizes.denseRows, 12);
+        dense->recalculate();
+    }
+    QScopedPointer<Sheet> strings(newSheet(threads));
+    if (fileBenchmarkSelected(runner, "strings"))
+        Generators::strings(strings.data(), sizes.stringRows, 5);
+
+    struct Workload
+    {
+        const char *name;
+        Sheet *sheet;
+    };
+    const Workload workloads[] = {
+        { "dense", dense.data() },
+        { "strings", strings.data() }
+    };
+
+    for (const Workload &workload : workloads) {
+        if (!fileBenchmarkSelected(runner, workload.name))
+            continue;
+        Sheet *sheet = workload.sheet;
+        QString fileName = dir.filePath(QString(workload.name) + ".sps");
+        QString csvName = dir.filePath(QString(workload.name) + ".csv");
+        qint64 cells = sheet->cells().count();
+
+        runner->run("write", workload.name, cells, threads, 0, [&]() {
+            SheetFile::write(*sheet, fileName, &errorString);
+        });
+        SheetFile::write(*sheet, fileName, &errorString);
+
+        QScopedPointer<Sheet> loaded;
+        runner->run("read", workload.name, cells, threads,
+                    [&]() { loaded.reset(newSheet(threads)); },
+                    [&]() { SheetFile::read(loaded.data(), fileName,
+                                            &errorString); });
+
+        // Opens the file into the same sheet again and again, clearing
+        // it in between, as opening one file after another does.
+        enum { LoadClearCycles = 3 };
+        runner->run("load-clear", workload.name, cells, threads,
+                    [&]() { loaded.reset(newSheet(threads)); },
+                    [&]() {
+            for (int i = 0; i < LoadClearCycles; ++i) {
+                SheetFile::read(loaded.data(), fileName, &errorString);
+                loaded->clear();
+            }
+        });
+
+        PreviewProgress preview;
+        runner->run("read-preview", workload.name, cells, threads,
+                    [&]() { loaded.reset(newSheet(threads));
+                            preview.done = false; },
+                    [&]() { SheetFile::read(loaded.data(), fileName,
+                                            &errorString, 0, &preview); });
+
+        runner->run("csv-write", workload.name, cells, threads, 0, [&]() {
+            CsvFile::write(sheet, csvName, ',', &errorString);
+        });
+        CsvFile::write(sheet, csvName, ',', &errorString);
+
+        runner->run("csv-read", workload.name, cells, threads,
+                    [&]() { loaded.reset(newSheet(threads)); },
+                    [&]() { CsvFile::read(loaded.data(), csvName, ',',
+                                          &errorString); });
+    }
+
+    // A save after a small edit only appends the edited cells, so its
+    // cost should not depend on the size of the sheet.
+    if (runner->isSelected("append/dense")) {
+        enum { EditSize = 100 };
+        QString fileName = dir.filePath("append.sps");
+        SheetFile::Extent extent;
+        SheetFile::write(*dense, fileName, &errorString, &extent);
+
+        QVector<quint64> edited;
+        for (int row = 0; row < EditSize; ++row)
+            edited.append(DependencyGraph::key(row, 0));
+        runner->run("append", "dense", EditSize, 1, 0, [&]() {
+            SheetFile::append(*dense, edited, fileName, &extent,
+                              &errorString);
+        });
+    }
+}
+
+void findBenchmarks(BenchmarkRunner *runner, const Sizes &sizes,
+                    int threads)
+{
+    if (!runner->isSelected("find-index/strings")
+            && !runner->isSelected("findNext/strings"))
+        return;
+
+    QScopedPointer<Sheet> sheet(newSheet(threads));
+    Generators::strings(sheet.data(), sizes.stringRows, 5);
+    qint64 cells = sheet->cells().count();
+
+    QScopedPointer<SearchIndex> index(new SearchIndex);
+    runner->run("find-index", "strings", cells, 1,
+                [&]() { index.reset(new SearchIndex); },
+                [&]() { index->find(sheet.data(), "quabri",
+                                    Qt::CaseInsensitive); });
+
+    // Steps through the first hundred matches the way repeated Find
+    // Next presses would.  The setup builds the index, since the run
+    // above may have been filtered out.
+    auto buildIndex = [&]() { index->find(sheet.data(), "quabri",
+                                          Qt::CaseInsensitive); };
+    runner->run("findNext", "strings", cells, 1, buildIndex, [&]() {
+        quint64 current = 0;
+        for (int i = 0; i < 100; ++i) {
+            QVector<quint64> matches = index->find(sheet.data(), "quabri",
+                                                   Qt::CaseInsensitive);
+            QVector<quint64>::const_iterator next = std::upper_bound(
+                    matches.constBegin(), matches.constEnd(), current);
+            if (next == matches.constEnd())
+                break;
+            current = *next;
+        }
+    });
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("spbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+            "Times the spreadsheet engine on synthetic workbooks and "
+            "prints the results as JSON.");
+    parser.addHelpOption();
+
+    QCommandLineOption scaleOption(QStringList() << "s" << "scale",
+            "Multiplies the size of every workload.", "factor", "1");
+    QCommandLineOption repeatOption(QStringList() << "r" << "repeat",
+            "Runs of each benchmark.", "count", "5");
+    QCommandLineOption filterOption(QStringList() << "f" << "filter",
+            "Only runs benchmarks whose benchmark/workload name matches.",
+            "regexp");
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+            "Recalculation threads.", "count",
+            QString::number(QThread::idealThreadCount()));
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+            "Writes the results to a file instead of stdout.", "file");
+
+    parser.addOption(scaleOption);
+    parser.addOption(repeatOption);
+    parser.addOption(filterOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    double scale = qMax(0.001, parser.value(scaleOption).toDouble());
+    int threads = qMax(1, parser.value(threadsOption).toInt());
+
+    Sizes sizes;
+    sizes.denseRows = qMin(int(20000 * scale), int(Sheet::RowCount));
+    sizes.chainLength = qMin(int(100000 * scale), int(Sheet::RowCount));
+    sizes.fanWidth = qMin(int(100000 * scale), int(Sheet::RowCount));
+    sizes.sumRows = qMin(int(1000000 * scale), int(Sheet::RowCount));
+    sizes.stringRows = qMin(int(20000 * scale), int(Sheet::RowCount));
+    sizes.pasteRows = qMin(int(10000 * scale), int(Sheet::RowCount));
+    sizes.lookupRows = qMin(int(100000 * scale), int(Sheet::RowCount));
+
+    BenchmarkRunner runner(parser.value(repeatOption).toInt(),
+                           parser.value(filterOption));
+    bool ok = recalculationBenchmarks(&runner, sizes, threads);
+    editBenchmarks(&runner, sizes, threads);
+    fileBenchmarks(&runner, sizes, threads);
+    findBenchmarks(&runner, sizes, threads);
+
+    QJsonObject report;
+    report.insert("scale", scale);
+    report.insert("qt", QString(qVersion()));
+    report.insert("benchmarks", runner.results());
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) < 0) {
+            QTextStream(stderr) << file.fileName() << ": "
+                                << file.errorString() << '\n';
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include "referenceevaluator.h"
+#include "sheet.h"
+
+static const QVariant Invalid;
+
+ReferenceEvaluator::ReferenceEvaluator(const Sheet &sheet)
+{
+    const CellStore &cells = sheet.cells();
+    for (CellStore::const_iterator i = cells.begin(); i != cells.end(); ++i)
+        formulas.insert(DependencyGraph::key(i.row(), i.column()),
+                        i->formula(i.row(), i.column(), cells.strings()));
+}
+
+void ReferenceEvaluator::recalculate()
+{
+    cache.clear();
+    QHash<quint64, QString>::const_iterator i = formulas.constBegin();
+    for (; i != formulas.constEnd(); ++i)
+        value(DependencyGraph::row(i.key()), DependencyGraph::column(i.key()));
+}
+
+QVariant ReferenceEvaluator::value(int row, int column)
+{
+    quint64 key = DependencyGraph::key(row, column);
+    QHash<quint64, QVariant>::const_iterator cached = cache.constFind(key);
+    if (cached != cache.constEnd())
+        return cached.value();
+
+    QVariant result;
+    QString formulaStr = formulas.value(key);
+    if (formulaStr.startsWith('\'')) {
+        result = formulaStr.mid(1);
+    } else if (formulaStr.startsWith('=')) {
+        QString expr = formulaStr.mid(1);
+        expr.replace(" ", "");
+        expr.append(QChar::Null);
+
+        int pos = 0;
+        result = evalExpression(expr, pos);
+        if (expr[pos] != QChar::Null)
+            result = Invalid;
+    } else {
+        bool ok;
+        double d = formulaStr.toDouble(&ok);
+        if (ok) {
+            result = d;
+        } else {
+            result = formulaStr;
+        }
+    }
+    cache.insert(key, result);
+    return result;
+}
+
+QVariant ReferenceEvaluator::evalExpression(const QString &str, int &pos)
+{
+    QVariant result = evalTerm(str, pos);
+    while (str[pos] != QChar::Null) {
+        QChar op = str[pos];
+        if (op != '+' && op != '-')
+            return result;
+        ++pos;
+
+        QVariant term = evalTerm(str, pos);
+        if (result.type() == QVariant::Double
+                && term.type() == QVariant::Double) {
+            if (op == '+') {
+                result = result.toDouble() + term.toDouble();
+            } else {
+                result = result.toDouble() - term.toDouble();
+            }
+        } else {
+            result = Invalid;
+        }
+    }
+    return result;
+}
+
+QVariant ReferenceEvaluator::evalTerm(const QString &str, int &pos)
+{
+    QVariant result = evalFactor(str, pos);
+    while (str[pos] != QChar::Null) {
+        QChar op = str[pos];
+        if (op != '*' && op != '/')
+            return result;
+        ++pos;
+
+        QVariant factor = evalFactor(str, pos);
+        if (result.type() == QVariant::Double
+                && factor.type() == QVariant::Double) {
+            if (op == '*') {
+                result = result.toDouble() * factor.toDouble();
+            } else if (factor.toDouble() == 0.0) {
+                result = Invalid;
+            } else {
+                result = result.toDouble() / factor.toDouble();
+            }
+        } else {
+            result = Invalid;
+        }
+    }
+    return result;
+}
+
+QVariant ReferenceEvaluator::evalFactor(const QString &str, int &pos)
+{
+    QVariant result;
+    bool negative = false;
+
+    if (str[pos] == '-') {
+        negative = true;
+        ++pos;
+    }
+
+    if (str[pos] == '(') {
+        ++pos;
+        result = evalExpression(str, pos);
+        if (str[pos] != ')')
+            result = Invalid;
+        ++pos;
+    } else {
+        QString token;
+        while (str[pos].isLetterOrNumber() || str[pos] == '.') {
+            token += str[pos];
+            ++pos;
+        }
+
+        CellReference ref;
+        if (CellReference::parse(token, &ref)) {
+            if (formulas.contains(DependencyGraph::key(ref.row, ref.column))) {
+                result = value(ref.row, ref.column);
+            } else {
+                result = 0.0;
+            }
+        } else {
+            bool ok;
+            result = token.toDouble(&ok);
+            if (!ok)
+                result = Invalid;
+        }
+    }
+
+    if (negative) {
+        if (result.type() == QVariant::Double) {
+            result = -result.toDouble();
+        } else {
+            result = Invalid;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef REFERENCEEVALUATOR_H
+#define REFERENCEEVALUATOR_H
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+
+class Sheet;
+
+// The evaluator the engine replaced, kept as a baseline: formulas are
+// re-parsed from their text on every evaluation, references are
+// followed recursively and values travel as QVariants.  It understands
+// numbers, cell references and the four operators only, and recurses
+// once per link of a chain, so it is only fed short chains.
+class ReferenceEvaluator
+{
+public:
+    explicit ReferenceEvaluator(const Sheet &sheet);
+
+    void recalculate();
+    QVariant value(int row, int column);
+
+private:
+    QVariant evalExpression(const QString &str, int &pos);
+    QVariant evalTerm(const QString &str, int &pos);
+    QVariant evalFactor(const QString &str, int &pos);
+
+    QHash<quint64, QString> formulas;
+    QHash<quint64, QVariant> cache;
+};
+
+#endif // REFERENCEEVALUATOR_H
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Engine benchmarks on synthetic workbooks
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = spbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../engine.pri)
+
+SOURCES += main.cpp \
+    allocationcounter.cpp \
+    benchmarkrunner.cpp \
+    generators.cpp \
+    referenceevaluator.cpp
+
+HEADERS += allocationcounter.h \
+    benchmarkrunner.h \
+    generators.h \
+    referenceevaluator.h
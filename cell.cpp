@@ -1,188 +1,84 @@
 #include "cell.h"
 
 Cell::Cell()
+    : textId(-1)
 {
-    setDirty();
 }
 
-QTableWidgetItem *Cell::clone() const
+// Formulas keep no text of their own: it is rebuilt from the shared
+// program, which knows it relative to the cell.  Other texts live in
+// the string pool, so a cell holds no heap memory of its own and texts
+// repeated down a column are stored once.
+void Cell::setFormula(const QString &formula, int row, int column,
+                      StringPool *strings, FormulaPool *formulas)
 {
-    return new Cell(*this);
-}
-
-void Cell::setFormula(const QString &formula)
-{
-    setData(Qt::EditRole, formula);
-}
-
-QString Cell::formula() const
-{
-    return data(Qt::EditRole).toString();
-}
-
-void Cell::setData(int role, const QVariant &value)
-{
-    QTableWidgetItem::setData(role, value);
-    if (role == Qt::EditRole)
-        setDirty();
-}
-
-void Cell::setDirty()
-{
-    cacheIsDirty = true;
-}
-
-QVariant Cell::data(int role) const
-{
-    if (role == Qt::DisplayRole) {
-        if (value().isValid()) {
-            return value().toString();
-        } else {
-            return "####";
-        }
-    } else if (role ==Qt::TextAlignmentRole) {
-        if (value().type() == QVariant::String) {
-            return int(Qt::AlignLeft | Qt::AlignVCenter);
+    program = Formula();
+    cachedValue = Value();
+    textId = -1;
+
+    if (formula.startsWith('\'')) {
+        cachedValue = Value::fromString(strings->intern(formula.mid(1)));
+        textId = strings->intern(formula);
+    } else if (formula.startsWith('=')) {
+        program = formulas->compile(formula.mid(1), row, column);
+    } else {
+        bool ok;
+        double d = formula.toDouble(&ok);
+        if (ok) {
+            cachedValue = Value::fromNumber(d);
+            // Plain numbers are rebuilt from the value on demand, so
+            // only keep the text when it would not round-trip.
+            if (QString::number(d, 'g', 15) != formula)
+                textId = strings->intern(formula);
         } else {
-            return int(Qt::AlignRight | Qt::AlignVCenter);
+            cachedValue = Value::fromString(strings->intern(formula));
+            textId = cachedValue.stringId();
         }
-    } else {
-        return QTableWidgetItem::data(role);
     }
 }
 
-const QVariant Invalid;
-
-QVariant Cell::value() const
+// Rebuilds a cell from its saved parts without reparsing anything.  A
+// null formula stands for a plain number whose text is its value, or
+// for a formula whose text comes from its program.
+void Cell::restore(const QString &formula, const Formula &compiled,
+                   const Value &value, StringPool *strings)
 {
-    if (cacheIsDirty) {
-        cacheIsDirty = false;
-
-        QString formulaStr = formula();
-        if (formulaStr.startsWith('\'')) {
-            cachedValue = formulaStr.mid(1);
-        } else if (formulaStr.startsWith('=')) {
-            cachedValue = Invalid;
-            QString expr = formulaStr.mid(1);
-            expr.replace(" ", "");
-            expr.append(QChar::Null);
-
-            int pos = 0;
-            cachedValue = evalExpression(expr, pos);
-            if (expr[pos] != QChar::Null)
-                cachedValue = Invalid;
-        } else {
-            bool ok;
-            double d = formulaStr.toDouble(&ok);
-            if (ok) {
-                cachedValue = d;
-            } else {
-                cachedValue = formulaStr;
-            }
-        }
+    textId = -1;
+    if (!formula.isNull()) {
+        if (value.isString() && strings->string(value.stringId()) == formula)
+            textId = value.stringId();
+        else
+            textId = strings->intern(formula);
     }
-    return cachedValue;
+    program = compiled;
+    cachedValue = value;
 }
 
-QVariant Cell::evalExpression(const QString &str, int &pos) const
+QString Cell::formula(int row, int column, const StringPool &strings) const
 {
-    QVariant result = evalTerm(str, pos);
-    while (str[pos] != QChar::Null) {
-        QChar op = str[pos];
-        if (op != '+' && op != '-')
-            return result;
-        ++pos;
-
-        QVariant term = evalTerm(str, pos);
-        if (result.type() == QVariant::Double
-                && term.type() == QVariant::Double) {
-            if (op == '+') {
-                result = result.toDouble() + term.toDouble();
-            } else {
-                result = result.toDouble() - term.toDouble();
-            }
-        } else {
-            result = Invalid;
-        }
-    }
-    return result;
+    if (!program.isNull())
+        return '=' + program.toString(row, column);
+    if (textId >= 0)
+        return strings.string(textId);
+    if (cachedValue.isNumber())
+        return QString::number(cachedValue.toNumber(), 'g', 15);
+    return QString();
 }
 
-QVariant Cell::evalTerm(const QString &str, int &pos) const
+void Cell::markStrings(QBitArray *used) const
 {
-    QVariant result = evalFactor(str, pos);
-    while (str[pos] != QChar::Null) {
-        QChar op = str[pos];
-        if (op != '*' && op != '/')
-            return result;
-        ++pos;
-
-        QVariant factor = evalFactor(str, pos);
-        if (result.type() == QVariant::Double
-                && factor.type() == QVariant::Double) {
-            if (op == '*') {
-                result = result.toDouble() * factor.toDouble();
-            } else {
-                if (factor.toDouble() == 0.0) {
-                    result = Invalid;
-                } else {
-                    result = result.toDouble() / factor.toDouble();
-                }
-            }
-        } else {
-            result = Invalid;
-        }
-    }
-    return result;
+    if (textId >= 0)
+        used->setBit(textId);
+    if (cachedValue.isString())
+        used->setBit(cachedValue.stringId());
 }
 
-QVariant Cell::evalFactor(const QString &str, int &pos) const
+QVector<CellReference> Cell::references(int row, int column) const
 {
-    QVariant result;
-    bool negative = false;
-
-    if (str[pos] == '-') {
-        negative = true;
-        ++pos;
-
-        if (str[pos] != ')')
-            result = Invalid;
-        ++pos;
-    } else {
-        QRegExp regExp("[A-Za-z][1-9][0-9]{0,2}");
-        QString token;
-
-        while (str[pos].isLetterOrNumber() || str[pos] == '.') {
-            token += str[pos];
-            ++pos;
-        }
-
-        if (regExp.exactMatch(token)) {
-            int column = token[0].toUpper().unicode() - 'A';
-            int row = token.mid(1).toInt() - 1;
-
-            Cell *c = static_cast<Cell *>(
-                                tableWidget()->item(row, column));
-            if (c) {
-                result = c->value();
-            } else {
-                result = 0.0;
-            }
-         } else {
-             bool ok;
-             result = token.toDouble(&ok);
-             if (!ok)
-                result = Invalid;
-         }
-    }
-
-    if (negative) {
-        if (result.type() == QVariant::Double) {
-            result = -result.toDouble();
-        } else {
-            result = Invalid;
-        }
-    }
-    return result;
+    return program.references(row, column);
+}
 
+QVector<CellRange> Cell::ranges(int row, int column) const
+{
+    return program.ranges(row, column);
 }
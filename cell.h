@@ -1,28 +1,38 @@
 #ifndef CELL_H
 #define CELL_H
 
-#include <QTableWidgetItem>
+#include <QString>
 
-class Cell : public QTableWidgetItem
+#include "formula.h"
+#include "formulapool.h"
+#include "stringpool.h"
+#include "value.h"
+
+class Cell
 {
 public:
     Cell();
 
-    QTableWidgetItem *clone() const;
-    void setData(int role, const QVariant &value);
-    QVariant data(int role) const;
-    void setFormula(const QString &formula);
-    QString formula() const;
-    void setDirty();
+    void setFormula(const QString &formula, int row, int column,
+                    StringPool *strings, FormulaPool *formulas);
+    void restore(const QString &formula, const Formula &compiled,
+                 const Value &value, StringPool *strings);
+    QString formula(int row, int column, const StringPool &strings) const;
+    const Formula &compiledFormula() const { return program; }
+    QVector<CellReference> references(int row, int column) const;
+    QVector<CellRange> ranges(int row, int column) const;
+    bool hasFormula() const { return !program.isNull(); }
+    void markStrings(QBitArray *used) const;
 
-private:
-    QVariant value() const;
-    QVariant evalExpression(const QString &str, int &pos) const;
-    QVariant evalTerm(const QString &str, int &pos) const;
-    QVariant evalFactor(const QString &str, int &pos) const;
+    Value value() const { return cachedValue; }
+    void setValue(const Value &value) { cachedValue = value; }
 
-    mutable QVariant cachedValue;
-    mutable bool cacheIsDirty;
+private:
+    // The text as typed, interned in the sheet's string pool, or -1
+    // when it is rebuilt from the program or the value.
+    int textId;
+    Formula program;
+    Value cachedValue;
 };
 
 #endif // CELL_H
@@ -0,0 +1,60 @@
+#include "cellreference.h"
+
+QString CellReference::columnName(int column)
+{
+    QString name;
+    ++column;
+    while (column > 0) {
+        --column;
+        name.prepend(QChar('A' + column % 26));
+        column /= 26;
+    }
+    return name;
+}
+
+int CellReference::columnNumber(const QString &name)
+{
+    if (name.isEmpty() || name.length() > 3)
+        return -1;
+
+    int column = 0;
+    for (int i = 0; i < name.length(); ++i) {
+        ushort ch = name[i].toUpper().unicode();
+        if (ch < 'A' || ch > 'Z')
+            return -1;
+        column = column * 26 + (ch - 'A' + 1);
+    }
+    --column;
+    return column < MaxColumns ? column : -1;
+}
+
+bool CellReference::parse(const QString &name, CellReference *ref)
+{
+    int letters = 0;
+    while (letters < name.length() && name[letters].isLetter())
+        ++letters;
+
+    int digits = name.length() - letters;
+    if (letters == 0 || digits == 0 || digits > 7 || name[letters] == '0')
+        return false;
+
+    int row = 0;
+    for (int i = letters; i < name.length(); ++i) {
+        if (!name[i].isDigit())
+            return false;
+        row = row * 10 + name[i].digitValue();
+    }
+
+    int column = columnNumber(name.left(letters));
+    if (column < 0 || row > MaxRows)
+        return false;
+
+    ref->row = row - 1;
+    ref->column = column;
+    return true;
+}
+
+QString CellReference::toString() const
+{
+    return columnName(column) + QString::number(row + 1);
+}
@@ -0,0 +1,31 @@
+#ifndef CELLREFERENCE_H
+#define CELLREFERENCE_H
+
+#include <QString>
+
+struct CellReference
+{
+    enum { MaxRows = 1048576, MaxColumns = 16384 };
+
+    int row;
+    int column;
+
+    static QString columnName(int column);
+    static int columnNumber(const QString &name);
+    static bool parse(const QString &name, CellReference *ref);
+    QString toString() const;
+};
+
+struct CellRange
+{
+    int top;
+    int left;
+    int bottom;
+    int right;
+
+    bool contains(int row, int column) const
+        { return row >= top && row <= bottom
+                 && column >= left && column <= right; }
+};
+
+#endif // CELLREFERENCE_H
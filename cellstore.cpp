@@ -0,0 +1,498 @@
+#include "cellstore.h"
+#include "dependencygraph.h"
+
+#include <QtAlgorithms>
+
+#include <limits>
+
+#include <string.h>
+
+static inline quint64 spanMask(int first, int last)
+{
+    return (~Q_UINT64_C(0) >> (CellStore::ChunkSize - 1 - last))
+           & (~Q_UINT64_C(0) << first);
+}
+
+CellStore::Chunk::Chunk()
+    : version(0), used(0), dirty(0), numeric(0), errors(0), sum(0.0),
+      min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity())
+{
+    memset(numbers, 0, sizeof(numbers));
+}
+
+// Called after a slot has been written; `old` is the number it held
+// if it held one.  The sum is always recomputed, since adding and
+// subtracting would drift, but the extremes only need a rescan when
+// the number that was one of them went away.
+void CellStore::Chunk::updateSummary(int slot, bool wasNumeric, double old)
+{
+    updateSum();
+    if (wasNumeric && (old <= min || old >= max)) {
+        rescanExtremes();
+    } else if (numeric & (Q_UINT64_C(1) << slot)) {
+        min = qMin(min, numbers[slot]);
+        max = qMax(max, numbers[slot]);
+    }
+}
+
+void CellStore::Chunk::updateSum()
+{
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    for (int i = 0; i < ChunkSize; i += 4) {
+        s0 += numbers[i];
+        s1 += numbers[i + 1];
+        s2 += numbers[i + 2];
+        s3 += numbers[i + 3];
+    }
+    sum = (s0 + s1) + (s2 + s3);
+}
+
+void CellStore::Chunk::rescanExtremes()
+{
+    min = std::numeric_limits<double>::infinity();
+    max = -std::numeric_limits<double>::infinity();
+    for (quint64 bits = numeric; bits; bits &= bits - 1) {
+        double x = numbers[qCountTrailingZeroBits(bits)];
+        min = qMin(min, x);
+        max = qMax(max, x);
+    }
+}
+
+CellStore::const_iterator::const_iterator(ChunkMap::const_iterator first,
+                                          ChunkMap::const_iterator last)
+    : chunk(first), end(last), slot(0)
+{
+    skipUnused();
+}
+
+int CellStore::const_iterator::row() const
+{
+    return int(chunk.key() >> 32) * ChunkSize + slot;
+}
+
+int CellStore::const_iterator::column() const
+{
+    return int(chunk.key() & 0xffffffff);
+}
+
+CellStore::const_iterator &CellStore::const_iterator::operator++()
+{
+    ++slot;
+    skipUnused();
+    return *this;
+}
+
+void CellStore::const_iterator::skipUnused()
+{
+    while (chunk != end) {
+        if (slot < ChunkSize) {
+            quint64 remaining = chunk.value()->used >> slot;
+            if (remaining) {
+                slot += qCountTrailingZeroBits(remaining);
+                return;
+            }
+        }
+        ++chunk;
+        slot = 0;
+    }
+}
+
+CellStore::CellStore()
+    : cellCount(0), clearVersion(0), lastVersion(0)
+{
+}
+
+const Cell *CellStore::cell(int row, int column) const
+{
+    ChunkMap::const_iterator i = chunks.constFind(chunkKey(row, column));
+    if (i == chunks.constEnd())
+        return 0;
+
+    int slot = row % ChunkSize;
+    const Chunk *chunk = i.value().constData();
+    if (chunk->used & (Q_UINT64_C(1) << slot))
+        return &chunk->cells[slot];
+    return 0;
+}
+
+void CellStore::setFormula(int row, int column, const QString &formula)
+{
+    if (formula.isEmpty()) {
+        remove(row, column);
+        return;
+    }
+
+    Cell *cell = insert(row, column);
+    cell->setFormula(formula, row, column, &stringPool, &formulaPool);
+    setValue(row, column, cell->value());
+    if (cell->hasFormula())
+        setDirty(row, column);
+}
+
+void CellStore::restore(int row, int column, const QString &formula,
+                        const Formula &compiled, const Value &value)
+{
+    insert(row, column)->restore(formula, formulaPool.insert(compiled),
+                                 value, &stringPool);
+    setValue(row, column, value);
+}
+
+// Copies a cell to another position.  Formulas are relative to their
+// cell, so the copy shares the source's program and is left dirty.
+void CellStore::copy(int fromRow, int fromColumn, int toRow, int toColumn)
+{
+    const Cell *source = cell(fromRow, fromColumn);
+    if (!source) {
+        remove(toRow, toColumn);
+        return;
+    }
+
+    Cell copy = *source;
+    if (copy.hasFormula())
+        copy.setValue(Value());
+    put(toRow, toColumn, copy);
+}
+
+// Stores a cell as it is, sharing its program and text.  A formula
+// keeps its cached value but is dirtied.
+void CellStore::put(int row, int column, const Cell &cell)
+{
+    *insert(row, column) = cell;
+    setValue(row, column, cell.value());
+    if (cell.hasFormula())
+        setDirty(row, column);
+}
+
+void CellStore::setValue(int row, int column, const Value &value)
+{
+    int slot;
+    Chunk *c = chunk(row, column, &slot);
+    if (!c)
+        return;
+
+    c->version = touch(column);
+
+    quint64 bit = Q_UINT64_C(1) << slot;
+    bool wasNumeric = c->numeric & bit;
+    double old = c->numbers[slot];
+    c->cells[slot].setValue(value);
+    c->dirty &= ~bit;
+    c->numeric &= ~bit;
+    c->errors &= ~bit;
+    c->numbers[slot] = 0.0;
+
+    if (value.isNumber()) {
+        c->numeric |= bit;
+        c->numbers[slot] = value.toNumber();
+        if (wasNumeric && old == value.toNumber())
+            return;
+    } else if (value.isError()) {
+        c->errors |= bit;
+    }
+    if (wasNumeric || value.isNumber())
+        c->updateSummary(slot, wasNumeric, old);
+}
+
+bool CellStore::setDirty(int row, int column)
+{
+    int slot;
+    Chunk *c = chunk(row, column, &slot);
+    if (!c || !c->cells[slot].hasFormula())
+        return false;
+
+    c->dirty |= Q_UINT64_C(1) << slot;
+    return true;
+}
+
+bool CellStore::isDirty(int row, int column) const
+{
+    ChunkMap::const_iterator i = chunks.constFind(chunkKey(row, column));
+    if (i == chunks.constEnd())
+        return false;
+    return i.value().constData()->dirty & (Q_UINT64_C(1) << (row % ChunkSize));
+}
+
+void CellStore::remove(int row, int column)
+{
+    ChunkMap::iterator i = chunks.find(chunkKey(row, column));
+    if (i == chunks.end())
+        return;
+
+    int slot = row % ChunkSize;
+    quint64 bit = Q_UINT64_C(1) << slot;
+    if (!(i.value().constData()->used & bit))
+        return;
+    quint64 version = touch(column);
+
+    if (i.value().constData()->used == bit) {
+        chunks.erase(i);
+    } else {
+        Chunk *chunk = i.value().data();
+        chunk->version = version;
+        bool wasNumeric = chunk->numeric & bit;
+        double old = chunk->numbers[slot];
+        chunk->cells[slot] = Cell();
+        chunk->used &= ~bit;
+        chunk->dirty &= ~bit;
+        chunk->numeric &= ~bit;
+        chunk->errors &= ~bit;
+        chunk->numbers[slot] = 0.0;
+        if (wasNumeric)
+            chunk->updateSummary(slot, wasNumeric, old);
+    }
+    --cellCount;
+}
+
+// Removes every cell in a range.  Chunks the range covers completely
+// are dropped whole, with their cells, and the others are cleared slot
+// by slot with a single summary update each.
+void CellStore::remove(const CellRange &range)
+{
+    foreach (const Span &span, spans(range)) {
+        quint64 key = chunkKey(span.row, span.column);
+        quint64 doomed = span.chunk->used & spanMask(span.first, span.last);
+        if (!doomed)
+            continue;
+        quint64 version = touch(span.column);
+        cellCount -= qPopulationCount(doomed);
+
+        if (doomed == span.chunk->used) {
+            chunks.remove(key);
+            continue;
+        }
+
+        Chunk *chunk = chunks[key].data();
+        chunk->version = version;
+        bool hadNumbers = chunk->numeric & doomed;
+        for (quint64 bits = doomed; bits; bits &= bits - 1) {
+            int slot = qCountTrailingZeroBits(bits);
+            chunk->cells[slot] = Cell();
+            chunk->numbers[slot] = 0.0;
+        }
+        chunk->used &= ~doomed;
+        chunk->dirty &= ~doomed;
+        chunk->numeric &= ~doomed;
+        chunk->errors &= ~doomed;
+        if (hadNumbers) {
+            chunk->updateSum();
+            chunk->rescanExtremes();
+        }
+    }
+}
+
+void CellStore::clear()
+{
+    chunks.clear();
+    stringPool.clear();
+    formulaPool.clear();
+    cellCount = 0;
+    versions.clear();
+    clearVersion = ++lastVersion;
+}
+
+// Drops the strings no cell uses.  used comes marked with the ids
+// held outside the store, which must not hold any others.
+void CellStore::pruneStrings(QBitArray *used)
+{
+    used->resize(stringPool.count());
+    for (const_iterator i = begin(); i != end(); ++i)
+        i->markStrings(used);
+    stringPool.prune(*used);
+}
+
+quint64 CellStore::columnVersion(int column) const
+{
+    if (column < 0 || column >= versions.size())
+        return clearVersion;
+    return qMax(clearVersion, versions.at(column));
+}
+
+// Identifies the contents of a range by the number of chunks it
+// overlaps and the newest write stamp among them.  Stamps only grow,
+// so any later write to the range raises the stamp and any removal of
+// a whole chunk lowers the count.
+quint64 CellStore::rangeVersion(const CellRange &range, int *chunkCount) const
+{
+    QVector<Span> overlapped = spans(range);
+    quint64 version = 0;
+    foreach (const Span &span, overlapped)
+        version = qMax(version, span.chunk->version);
+    *chunkCount = overlapped.size();
+    return version;
+}
+
+// Returns one key per chunk: the chunk's first row divided by
+// ChunkSize in the high half and its column in the low half.
+QVector<quint64> CellStore::chunkKeys() const
+{
+    QVector<quint64> keys;
+    keys.reserve(chunks.size());
+    for (ChunkMap::const_iterator i = chunks.constBegin();
+         i != chunks.constEnd(); ++i)
+        keys.append(i.key());
+    return keys;
+}
+
+void CellStore::dirtyCells(const CellRange &range,
+                           QVector<quint64> *keys) const
+{
+    foreach (const Span &span, spans(range)) {
+        quint64 dirty = span.chunk->dirty & spanMask(span.first, span.last);
+        while (dirty) {
+            int slot = qCountTrailingZeroBits(dirty);
+            keys->append(DependencyGraph::key(span.row + slot, span.column));
+            dirty &= dirty - 1;
+        }
+    }
+}
+
+void CellStore::usedCells(const CellRange &range,
+                          QVector<quint64> *keys) const
+{
+    foreach (const Span &span, spans(range)) {
+        quint64 used = span.chunk->used & spanMask(span.first, span.last);
+        while (used) {
+            int slot = qCountTrailingZeroBits(used);
+            keys->append(DependencyGraph::key(span.row + slot, span.column));
+            used &= used - 1;
+        }
+    }
+}
+
+RangeSummary CellStore::summarize(const CellRange &range) const
+{
+    RangeSummary summary;
+
+    foreach (const Span &span, spans(range)) {
+        const Chunk *chunk = span.chunk;
+        quint64 mask = spanMask(span.first, span.last);
+
+        quint64 errors = chunk->errors & mask;
+        if (errors && !summary.error.isError()) {
+            summary.error = chunk->cells[qCountTrailingZeroBits(errors)].value();
+        }
+
+        quint64 numeric = chunk->numeric & mask;
+        if (!numeric)
+            continue;
+        summary.count += qPopulationCount(numeric);
+
+        if (span.first == 0 && span.last == ChunkSize - 1) {
+            summary.sum += chunk->sum;
+            summary.min = qMin(summary.min, chunk->min);
+            summary.max = qMax(summary.max, chunk->max);
+            continue;
+        }
+
+        // Non-numeric slots hold 0.0, so the whole window can be summed
+        // with independent accumulators.
+        const double *p = chunk->numbers + span.first;
+        const double *end = chunk->numbers + span.last + 1;
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        for (; end - p >= 4; p += 4) {
+            s0 += p[0];
+            s1 += p[1];
+            s2 += p[2];
+            s3 += p[3];
+        }
+        for (; p != end; ++p)
+            s0 += *p;
+        summary.sum += (s0 + s1) + (s2 + s3);
+
+        while (numeric) {
+            double x = chunk->numbers[qCountTrailingZeroBits(numeric)];
+            summary.min = qMin(summary.min, x);
+            summary.max = qMax(summary.max, x);
+            numeric &= numeric - 1;
+        }
+    }
+    return summary;
+}
+
+QVector<CellStore::Span> CellStore::spans(const CellRange &range) const
+{
+    QVector<Span> result;
+    int firstChunk = range.top / ChunkSize;
+    int lastChunk = range.bottom / ChunkSize;
+    qint64 candidates = qint64(lastChunk - firstChunk + 1)
+                        * (range.right - range.left + 1);
+
+    // Small ranges probe the hash directly; large ranges over a sparse
+    // sheet are cheaper to answer by walking the chunks that exist.
+    if (candidates <= chunks.size()) {
+        for (int column = range.left; column <= range.right; ++column) {
+            for (int n = firstChunk; n <= lastChunk; ++n) {
+                ChunkMap::const_iterator i =
+                        chunks.constFind(chunkKey(n * ChunkSize, column));
+                if (i == chunks.constEnd())
+                    continue;
+                Span span = { i.value().constData(), n * ChunkSize, column,
+                              qMax(range.top - n * ChunkSize, 0),
+                              qMin(range.bottom - n * ChunkSize,
+                                   int(ChunkSize) - 1) };
+                result.append(span);
+            }
+        }
+    } else {
+        for (ChunkMap::const_iterator i = chunks.constBegin();
+             i != chunks.constEnd(); ++i) {
+            int n = int(i.key() >> 32);
+            int column = int(i.key() & 0xffffffff);
+            if (n < firstChunk || n > lastChunk
+                    || column < range.left || column > range.right)
+                continue;
+            Span span = { i.value().constData(), n * ChunkSize, column,
+                          qMax(range.top - n * ChunkSize, 0),
+                          qMin(range.bottom - n * ChunkSize,
+                               int(ChunkSize) - 1) };
+            result.append(span);
+        }
+    }
+    return result;
+}
+
+CellStore::Chunk *CellStore::chunk(int row, int column, int *slot)
+{
+    ChunkMap::iterator i = chunks.find(chunkKey(row, column));
+    if (i == chunks.end())
+        return 0;
+
+    *slot = row % ChunkSize;
+    if (!(i.value().constData()->used & (Q_UINT64_C(1) << *slot)))
+        return 0;
+    return i.value().data();
+}
+
+quint64 CellStore::touch(int column)
+{
+    if (versions.isEmpty())
+        versions.resize(CellReference::MaxColumns);
+    versions[column] = ++lastVersion;
+    return lastVersion;
+}
+
+Cell *CellStore::insert(int row, int column)
+{
+    QSharedDataPointer<Chunk> &chunk = chunks[chunkKey(row, column)];
+    if (!chunk)
+        chunk = new Chunk;
+
+    int slot = row % ChunkSize;
+    quint64 bit = Q_UINT64_C(1) << slot;
+    if (!(chunk.constData()->used & bit)) {
+        chunk->used |= bit;
+        ++cellCount;
+    }
+    return &chunk->cells[slot];
+}
+
+CellStore::const_iterator CellStore::begin() const
+{
+    return const_iterator(chunks.constBegin(), chunks.constEnd());
+}
+
+CellStore::const_iterator CellStore::end() const
+{
+    return const_iterator(chunks.constEnd(), chunks.constEnd());
+}
@@ -0,0 +1,132 @@
+#ifndef CELLSTORE_H
+#define CELLSTORE_H
+
+#include <QHash>
+#include <QSharedData>
+#include <QSharedDataPointer>
+
+#include <QVector>
+
+#include "cell.h"
+
+class CellStore
+{
+public:
+    enum { ChunkSize = 64 };
+
+private:
+    struct Chunk : public QSharedData
+    {
+        Chunk();
+
+        void updateSummary(int slot, bool wasNumeric, double old);
+        void updateSum();
+        void rescanExtremes();
+
+        // The stamp of the last write to the chunk.
+        quint64 version;
+        quint64 used;
+        quint64 dirty;
+        quint64 numeric;
+        quint64 errors;
+        // Mirrors the numeric values so that ranges can be summed
+        // without touching the cells; other slots hold 0.0.
+        double numbers[ChunkSize];
+        // Sum, minimum and maximum of the numbers, kept up to date on
+        // every write so that ranges covering the whole chunk are
+        // summarized without looking at its slots.
+        double sum;
+        double min;
+        double max;
+        Cell cells[ChunkSize];
+    };
+
+    typedef QHash<quint64, QSharedDataPointer<Chunk> > ChunkMap;
+
+    struct Span
+    {
+        const Chunk *chunk;
+        int row;
+        int column;
+        int first;
+        int last;
+    };
+
+public:
+    class const_iterator
+    {
+    public:
+        int row() const;
+        int column() const;
+        const Cell &operator*() const { return chunk.value()->cells[slot]; }
+        const Cell *operator->() const { return &chunk.value()->cells[slot]; }
+        const_iterator &operator++();
+        bool operator==(const const_iterator &other) const
+            { return chunk == other.chunk && slot == other.slot; }
+        bool operator!=(const const_iterator &other) const
+            { return !(*this == other); }
+
+    private:
+        friend class CellStore;
+
+        const_iterator(ChunkMap::const_iterator first,
+                       ChunkMap::const_iterator last);
+        void skipUnused();
+
+        ChunkMap::const_iterator chunk;
+        ChunkMap::const_iterator end;
+        int slot;
+    };
+
+    CellStore();
+
+    const Cell *cell(int row, int column) const;
+    void setFormula(int row, int column, const QString &formula);
+    void restore(int row, int column, const QString &formula,
+                 const Formula &compiled, const Value &value);
+    void copy(int fromRow, int fromColumn, int toRow, int toColumn);
+    void put(int row, int column, const Cell &cell);
+    void setValue(int row, int column, const Value &value);
+    bool setDirty(int row, int column);
+    bool isDirty(int row, int column) const;
+    void remove(int row, int column);
+    void remove(const CellRange &range);
+    void clear();
+    int count() const { return cellCount; }
+    const StringPool &strings() const { return stringPool; }
+    int intern(const QString &str) { return stringPool.intern(str); }
+    void pruneStrings(QBitArray *used);
+    const FormulaPool &formulas() const { return formulaPool; }
+    quint64 version() const { return lastVersion; }
+    quint64 columnVersion(int column) const;
+    quint64 rangeVersion(const CellRange &range, int *chunkCount) const;
+
+    QVector<quint64> chunkKeys() const;
+    void dirtyCells(const CellRange &range, QVector<quint64> *keys) const;
+    void usedCells(const CellRange &range, QVector<quint64> *keys) const;
+    RangeSummary summarize(const CellRange &range) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    QVector<Span> spans(const CellRange &range) const;
+    Chunk *chunk(int row, int column, int *slot);
+    Cell *insert(int row, int column);
+    quint64 touch(int column);
+
+    static quint64 chunkKey(int row, int column)
+        { return (quint64(quint32(row / ChunkSize)) << 32) | quint32(column); }
+
+    ChunkMap chunks;
+    StringPool stringPool;
+    FormulaPool formulaPool;
+    int cellCount;
+    // Stamps of the last write to each column, for caches over the
+    // values; clear() stamps every column at once.
+    QVector<quint64> versions;
+    quint64 clearVersion;
+    quint64 lastVersion;
+};
+
+#endif // CELLSTORE_H
@@ -0,0 +1,170 @@
+#include "batchrunner.h"
+#include "csvfile.h"
+#include "sheet.h"
+#include "sheetfile.h"
+#include "valuewriter.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTextStream>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+static const char ResultTag[] = "RESULT";
+
+BatchRunner::BatchRunner(const QStringList &files, const Options &options,
+                         QObject *parent)
+    : QObject(parent), files(files), options(options), next(0),
+      running(0), failed(0)
+{
+}
+
+void BatchRunner::start()
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5 %6\n")
+           .arg("file", -32).arg("cells", 10).arg("load ms", 10)
+           .arg("calc ms", 10).arg("write ms", 10).arg("peak KiB", 10);
+    out.flush();
+
+    for (int i = 0; i < options.jobs; ++i)
+        startNext();
+    if (running == 0)
+        emit finished();
+}
+
+void BatchRunner::startNext()
+{
+    if (next >= files.size())
+        return;
+
+    QStringList arguments;
+    arguments << "--worker"
+              << "--format" << options.format
+              << "--threads" << QString::number(options.threads);
+    if (!options.outputDir.isEmpty())
+        arguments << "--output-dir" << options.outputDir;
+    arguments << files[next++];
+
+    QProcess *process = new QProcess(this);
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    connect(process, SIGNAL(finished(int, QProcess::ExitStatus)),
+            this, SLOT(workerFinished(int, QProcess::ExitStatus)));
+    process->start(QCoreApplication::applicationFilePath(), arguments);
+    ++running;
+}
+
+void BatchRunner::workerFinished(int exitCode, QProcess::ExitStatus status)
+{
+    QProcess *process = qobject_cast<QProcess *>(sender());
+    report(process, status == QProcess::NormalExit ? exitCode : -1);
+    process->deleteLater();
+
+    --running;
+    startNext();
+    if (running == 0)
+        emit finished();
+}
+
+void BatchRunner::report(QProcess *process, int exitCode)
+{
+    QTextStream out(stdout);
+    QString fileName = process->arguments().last();
+
+    QStringList fields;
+    foreach (const QString &line,
+             QString::fromUtf8(process->readAllStandardOutput()).split('\n')) {
+        if (line.startsWith(ResultTag))
+            fields = line.split('\t');
+    }
+
+    if (exitCode != 0 || fields.size() != 6) {
+        ++failed;
+        out << QString("%1 failed\n").arg(fileName, -32);
+    } else {
+        out << QString("%1 %2 %3 %4 %5 %6\n")
+               .arg(fileName, -32).arg(fields[1], 10).arg(fields[2], 10)
+               .arg(fields[3], 10).arg(fields[4], 10).arg(fields[5], 10);
+    }
+    out.flush();
+}
+
+int BatchRunner::runWorker(const QString &fileName, const Options &options)
+{
+    QTextStream err(stderr);
+    QString errorString;
+    QElapsedTimer timer;
+
+    // Loading with recalculation off keeps the two phases apart; turning
+    // it back on recalculates the whole sheet once.
+    Sheet sheet;
+    sheet.setThreadCount(options.threads);
+    sheet.setAutoRecalculate(false);
+
+    timer.start();
+    bool ok;
+    if (SheetFile::isSheetFile(fileName)) {
+        ok = SheetFile::read(&sheet, fileName, &errorString);
+    } else {
+        ok = SheetFile::importLegacy(&sheet, fileName, &errorString);
+    }
+    if (!ok) {
+        err << fileName << ": " << errorString << '\n';
+        return 1;
+    }
+    qint64 loadTime = timer.restart();
+
+    sheet.setAutoRecalculate(true);
+    qint64 calcTime = timer.restart();
+
+    QFileInfo info(fileName);
+    QString dir = options.outputDir.isEmpty() ? info.absolutePath()
+                                              : options.outputDir;
+    QString output = QDir(dir).filePath(info.completeBaseName() + '.'
+                                        + options.format);
+    if (options.format == "json") {
+        ok = ValueWriter::writeJson(&sheet, output, &errorString);
+    } else {
+        ok = CsvFile::write(&sheet, output, ',', &errorString);
+    }
+    if (!ok) {
+        err << output << ": " << errorString << '\n';
+        return 1;
+    }
+    qint64 writeTime = timer.elapsed();
+
+    QTextStream out(stdout);
+    out << ResultTag << '\t' << sheet.cells().count() << '\t' << loadTime
+        << '\t' << calcTime << '\t' << writeTime << '\t' << peakMemoryKiB()
+        << '\n';
+    return 0;
+}
+
+qint64 BatchRunner::peakMemoryKiB()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                             sizeof(counters)))
+        return qint64(counters.PeakWorkingSetSize / 1024);
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(Q_OS_DARWIN)
+    return qint64(usage.ru_maxrss / 1024);
+#else
+    return qint64(usage.ru_maxrss);
+#endif
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,51 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+#include <QVector>
+
+// Recalculates many files by running one worker process per file, a
+// few at a time.  Separate processes keep the files isolated and let
+// each report its own peak memory.
+class BatchRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        QString format;
+        QString outputDir;
+        int jobs;
+        int threads;
+    };
+
+    BatchRunner(const QStringList &files, const Options &options,
+                QObject *parent = 0);
+
+    void start();
+    int failures() const { return failed; }
+
+    static int runWorker(const QString &fileName, const Options &options);
+
+signals:
+    void finished();
+
+private slots:
+    void workerFinished(int exitCode, QProcess::ExitStatus status);
+
+private:
+    void startNext();
+    void report(QProcess *process, int exitCode);
+    static qint64 peakMemoryKiB();
+
+    QStringList files;
+    Options options;
+    int next;
+    int running;
+    int failed;
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,61 @@
+#include "batchrunner.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QThread>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("spcalc");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+            "Recalculates spreadsheet files and writes their values.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "Spreadsheet files (.sps, .sp).",
+                                 "files...");
+
+    QCommandLineOption formatOption(QStringList() << "f" << "format",
+            "Output format: csv or json.", "format", "csv");
+    QCommandLineOption outputOption(QStringList() << "o" << "output-dir",
+            "Directory for the output files; defaults to each input's.",
+            "dir");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+            "Files processed at once.", "count",
+            QString::number(QThread::idealThreadCount()));
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+            "Recalculation threads per file.", "count", "1");
+    QCommandLineOption workerOption("worker");
+    workerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+
+    parser.addOption(formatOption);
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(workerOption);
+    parser.process(app);
+
+    BatchRunner::Options options;
+    options.format = parser.value(formatOption).toLower();
+    options.outputDir = parser.value(outputOption);
+    options.jobs = qMax(1, parser.value(jobsOption).toInt());
+    options.threads = qMax(1, parser.value(threadsOption).toInt());
+
+    if (options.format != "csv" && options.format != "json")
+        parser.showHelp(1);
+
+    QStringList files = parser.positionalArguments();
+    if (files.isEmpty())
+        parser.showHelp(1);
+
+    if (parser.isSet(workerOption))
+        return BatchRunner::runWorker(files.first(), options);
+
+    BatchRunner runner(files, options);
+    QObject::connect(&runner, SIGNAL(finished()), &app, SLOT(quit()),
+                     Qt::QueuedConnection);
+    runner.start();
+    app.exec();
+    return runner.failures() ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Headless batch recalculation of spreadsheet files
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = spcalc
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../engine.pri)
+
+SOURCES += main.cpp \
+    batchrunner.cpp \
+    valuewriter.cpp
+
+HEADERS += batchrunner.h \
+    valuewriter.h
+
+win32: LIBS += -lpsapi
@@ -0,0 +1,95 @@
+#include "valuewriter.h"
+#include "sheet.h"
+
+#include <QFile>
+#include <QTextStream>
+
+#include <algorithm>
+
+static QString jsonString(const QString &text)
+{
+    QString escaped;
+    escaped.reserve(text.size() + 2);
+    escaped += '"';
+    foreach (QChar ch, text) {
+        switch (ch.unicode()) {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\r':
+            escaped += "\\r";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        default:
+            if (ch.unicode() < 0x20) {
+                escaped += QString("\\u%1").arg(ch.unicode(), 4, 16,
+                                                QChar('0'));
+            } else {
+                escaped += ch;
+            }
+        }
+    }
+    escaped += '"';
+    return escaped;
+}
+
+// Only populated cells are written, as {"cell": "B7", "value": ...}.
+// Numbers stay numbers; strings and error codes become JSON strings.
+bool ValueWriter::writeJson(Sheet *sheet, const QString &fileName,
+                            QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QVector<quint64> keys;
+    const CellStore &cells = sheet->cells();
+    for (CellStore::const_iterator i = cells.begin(); i != cells.end(); ++i)
+        keys.append(DependencyGraph::key(i.row(), i.column()));
+    std::sort(keys.begin(), keys.end());
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << "{\n  \"cells\": [";
+
+    bool first = true;
+    foreach (quint64 key, keys) {
+        int row = DependencyGraph::row(key);
+        int column = DependencyGraph::column(key);
+        CellReference ref = { row, column };
+
+        out << (first ? "\n    " : ",\n    ");
+        first = false;
+        out << "{\"cell\": " << jsonString(ref.toString()) << ", \"value\": ";
+
+        Value value = sheet->value(row, column);
+        if (value.isNumber() && qIsFinite(value.toNumber())) {
+            out << QString::number(value.toNumber(), 'g', 17);
+        } else if (value.isBool()) {
+            out << (value.toBool() ? "true" : "false");
+        } else if (value.isEmpty()) {
+            out << "null";
+        } else {
+            out << jsonString(sheet->text(row, column));
+        }
+        out << '}';
+    }
+    out << "\n  ]\n}\n";
+
+    out.flush();
+    if (out.status() != QTextStream::Ok) {
+        *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
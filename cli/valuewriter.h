@@ -0,0 +1,17 @@
+#ifndef VALUEWRITER_H
+#define VALUEWRITER_H
+
+#include <QString>
+
+class Sheet;
+
+// Writes the displayed values of a sheet as JSON; CSV output goes
+// through CsvFile.
+class ValueWriter
+{
+public:
+    static bool writeJson(Sheet *sheet, const QString &fileName,
+                          QString *errorString);
+};
+
+#endif // VALUEWRITER_H
@@ -0,0 +1,361 @@
+#include "csvfile.h"
+#include "sheet.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <charconv>
+#include <string.h>
+
+namespace {
+
+struct Field
+{
+    int row;
+    int column;
+    bool isNumber;
+    double number;
+    QString text;
+};
+
+struct Chunk
+{
+    const char *begin;
+    const char *end;
+    char separator;
+    int rows;
+    QVector<Field> fields;
+};
+
+void addField(Chunk *chunk, int row, int column, const char *begin,
+              const char *end)
+{
+    if (begin == end)
+        return;
+
+    Field field;
+    field.row = row;
+    field.column = column;
+    field.number = 0.0;
+
+    std::from_chars_result result = std::from_chars(begin, end, field.number);
+    field.isNumber = result.ec == std::errc() && result.ptr == end;
+    if (!field.isNumber)
+        field.text = QString::fromUtf8(begin, int(end - begin));
+    chunk->fields.append(field);
+}
+
+// Parses whole records; a chunk never starts or ends inside one.
+void parseChunk(Chunk &chunk)
+{
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    const char separator = chunk.separator;
+    QByteArray unquoted;
+    int row = 0;
+    int column = 0;
+
+    chunk.fields.reserve(int((end - p) / 8));
+    while (p < end) {
+        const char *start;
+        const char *stop;
+        if (*p == '"') {
+            unquoted.clear();
+            ++p;
+            while (p < end) {
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        unquoted.append('"');
+                        p += 2;
+                        continue;
+                    }
+                    ++p;
+                    break;
+                }
+                const char *quote = static_cast<const char *>(
+                        memchr(p, '"', size_t(end - p)));
+                if (!quote)
+                    quote = end;
+                unquoted.append(p, int(quote - p));
+                p = quote;
+            }
+            while (p < end && *p != separator && *p != '\n')
+                ++p;
+            start = unquoted.constData();
+            stop = start + unquoted.size();
+        } else {
+            start = p;
+            while (p < end && *p != separator && *p != '\n')
+                ++p;
+            stop = p;
+            if (stop > start && stop[-1] == '\r')
+                --stop;
+        }
+
+        addField(&chunk, row, column, start, stop);
+
+        if (p < end && *p == separator) {
+            ++p;
+            ++column;
+            if (p == end)
+                ++row;
+        } else {
+            if (p < end)
+                ++p;
+            ++row;
+            column = 0;
+        }
+    }
+    chunk.rows = row;
+}
+
+// Cuts [begin, end) into about `count` chunks at record boundaries,
+// tracking quotes so that line breaks inside quoted fields are not
+// taken for the end of a record.  Returns where the last complete
+// record ends; unless `atEnd`, the rest belongs to the next block.
+const char *splitRecords(const char *begin, const char *end, bool atEnd,
+                         int count, char separator, QVector<Chunk> *chunks)
+{
+    qint64 step = (end - begin) / count + 1;
+    const char *target = begin + step;
+    const char *chunkStart = begin;
+    const char *boundary = begin;
+    bool quoted = false;
+    bool fieldStart = true;
+
+    // Quotes are followed exactly as parseChunk() reads them: only one
+    // at the start of a field opens a quoted field, and inside one a
+    // doubled quote stands for itself.
+    for (const char *p = begin; p < end; ++p) {
+        if (quoted) {
+            if (*p == '"') {
+                if (p + 1 < end && p[1] == '"')
+                    ++p;
+                else
+                    quoted = false;
+            }
+        } else if (*p == '"' && fieldStart) {
+            quoted = true;
+            fieldStart = false;
+        } else if (*p == separator) {
+            fieldStart = true;
+        } else if (*p != '\n') {
+            fieldStart = false;
+        } else {
+            fieldStart = true;
+            boundary = p + 1;
+            if (boundary >= target) {
+                Chunk chunk = { chunkStart, boundary, separator, 0,
+                                QVector<Field>() };
+                chunks->append(chunk);
+                chunkStart = boundary;
+                target = boundary + step;
+            }
+        }
+    }
+
+    if (atEnd)
+        boundary = end;
+    if (chunkStart < boundary) {
+        Chunk chunk = { chunkStart, boundary, separator, 0,
+                        QVector<Field>() };
+        chunks->append(chunk);
+    }
+    return boundary;
+}
+
+void applyChunk(Sheet *sheet, const Chunk &chunk, int firstRow)
+{
+    foreach (const Field &field, chunk.fields) {
+        int row = firstRow + field.row;
+        if (row >= Sheet::RowCount || field.column >= Sheet::ColumnCount)
+            continue;
+
+        if (field.isNumber) {
+            sheet->setValue(row, field.column, QString(),
+                            Value::fromNumber(field.number));
+        } else if (field.text.startsWith('=')
+                   || field.text.startsWith('\'')) {
+            sheet->setFormula(row, field.column, field.text);
+        } else {
+            sheet->setValue(row, field.column, field.text,
+                            Value::fromString(sheet->intern(field.text)));
+        }
+    }
+}
+
+QByteArray csvField(const QString &text, QChar separator)
+{
+    QByteArray utf8 = text.toUtf8();
+    if (!text.contains(separator) && !text.contains('"')
+            && !text.contains('\n') && !text.contains('\r'))
+        return utf8;
+
+    utf8.replace("\"", "\"\"");
+    return '"' + utf8 + '"';
+}
+
+}
+
+bool CsvFile::isDelimited(const QString &fileName)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "csv" || suffix == "tsv" || suffix == "tab"
+            || suffix == "txt";
+}
+
+QChar CsvFile::separatorFor(const QString &fileName)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == "tsv" || suffix == "tab" || suffix == "txt")
+        return '\t';
+    return ',';
+}
+
+bool CsvFile::read(Sheet *sheet, const QString &fileName, QChar separator,
+                   QString *errorString, SheetFile::Progress *progress)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    qint64 size = file.size();
+    qint64 offset = 0;
+    qint64 blockSize = BlockSize;
+    int row = 0;
+
+    sheet->beginBatch();
+    while (offset < size) {
+        qint64 length = qMin(blockSize, size - offset);
+        bool atEnd = offset + length == size;
+
+        // Only one block is mapped at a time, which bounds the memory
+        // used by the import whatever the size of the file.
+        QByteArray copy;
+        const char *data = reinterpret_cast<const char *>(
+                file.map(offset, length));
+        if (!data) {
+            file.seek(offset);
+            copy = file.read(length);
+            data = copy.constData();
+        }
+
+        const char *begin = data;
+        if (offset == 0 && length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+            begin += 3;
+
+        QVector<Chunk> chunks;
+        const char *boundary = splitRecords(begin, data + length, atEnd,
+                                            threads, char(separator.toLatin1()),
+                                            &chunks);
+        if (boundary == begin && !atEnd) {
+            // A single record is longer than the block.
+            if (copy.isEmpty())
+                file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+            blockSize *= 2;
+            continue;
+        }
+
+        QtConcurrent::blockingMap(chunks, parseChunk);
+        foreach (const Chunk &chunk, chunks) {
+            applyChunk(sheet, chunk, row);
+            row += chunk.rows;
+        }
+
+        if (progress) {
+            // The first block holds the first rows, which is all the
+            // preview needs.
+            if (offset == 0)
+                progress->preview(*sheet);
+            if (!progress->progress(offset + (boundary - data), size)) {
+                if (copy.isEmpty())
+                    file.unmap(reinterpret_cast<uchar *>(
+                                   const_cast<char *>(data)));
+                sheet->commitBatch();
+                *errorString = QObject::tr("Loading was canceled");
+                return false;
+            }
+        }
+
+        offset += boundary - data;
+        if (copy.isEmpty())
+            file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    }
+    sheet->commitBatch();
+    return true;
+}
+
+// Writes displayed values row by row, walking the store one band of
+// chunk rows at a time so that only the populated columns are visited.
+bool CsvFile::write(Sheet *sheet, const QString &fileName, QChar separator,
+                    QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QVector<quint64> chunkKeys = sheet->cells().chunkKeys();
+    std::sort(chunkKeys.begin(), chunkKeys.end());
+
+    int lastColumn = -1;
+    foreach (quint64 key, chunkKeys)
+        lastColumn = qMax(lastColumn, int(key & 0xffffffff));
+
+    QByteArray buffer;
+    QByteArray padding(qMax(lastColumn, 0), char(separator.toLatin1()));
+    int nextRow = 0;
+    int i = 0;
+    while (i < chunkKeys.size()) {
+        int band = int(chunkKeys[i] >> 32);
+        QVector<int> columns;
+        for (; i < chunkKeys.size() && int(chunkKeys[i] >> 32) == band; ++i)
+            columns.append(int(chunkKeys[i] & 0xffffffff));
+
+        for (int row = band * CellStore::ChunkSize;
+             row < (band + 1) * CellStore::ChunkSize; ++row) {
+            QByteArray line;
+            int column = 0;
+            foreach (int c, columns) {
+                if (!sheet->cells().cell(row, c))
+                    continue;
+                line.append(QByteArray(c - column, char(separator.toLatin1())));
+                line.append(csvField(sheet->text(row, c), separator));
+                column = c;
+            }
+            if (line.isEmpty())
+                continue;
+
+            for (; nextRow < row; ++nextRow) {
+                buffer.append(padding);
+                buffer.append('\n');
+            }
+            buffer.append(line);
+            buffer.append(QByteArray(lastColumn - column,
+                                     char(separator.toLatin1())));
+            buffer.append('\n');
+            nextRow = row + 1;
+
+            if (buffer.size() >= 1024 * 1024) {
+                if (file.write(buffer) != buffer.size()) {
+                    *errorString = file.errorString();
+                    return false;
+                }
+                buffer.clear();
+            }
+        }
+    }
+
+    if (file.write(buffer) != buffer.size()) {
+        *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef CSVFILE_H
+#define CSVFILE_H
+
+#include <QChar>
+#include <QString>
+
+#include "sheetfile.h"
+
+class Sheet;
+
+// Streams delimited text in and out of a sheet.  Import works through
+// the file a block at a time; each block is cut into record-aligned
+// chunks that are parsed in parallel and then written into the sheet.
+class CsvFile
+{
+public:
+    enum { BlockSize = 16 * 1024 * 1024 };
+
+    static bool isDelimited(const QString &fileName);
+    static QChar separatorFor(const QString &fileName);
+    static bool read(Sheet *sheet, const QString &fileName, QChar separator,
+                     QString *errorString,
+                     SheetFile::Progress *progress = 0);
+    static bool write(Sheet *sheet, const QString &fileName, QChar separator,
+                      QString *errorString);
+};
+
+#endif // CSVFILE_H
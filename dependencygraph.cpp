@@ -0,0 +1,166 @@
+#include "dependencygraph.h"
+
+void DependencyGraph::setPrecedents(quint64 cell,
+                                    const QVector<quint64> &precedents,
+                                    const QVector<CellRange> &ranges)
+{
+    foreach (quint64 precedent, precedentMap.value(cell)) {
+        QHash<quint64, QSet<quint64> >::iterator i =
+                dependentMap.find(precedent);
+        if (i != dependentMap.end()) {
+            i.value().remove(cell);
+            if (i.value().isEmpty())
+                dependentMap.erase(i);
+        }
+    }
+
+    if (precedents.isEmpty()) {
+        precedentMap.remove(cell);
+    } else {
+        precedentMap.insert(cell, precedents);
+        foreach (quint64 precedent, precedents)
+            dependentMap[precedent].insert(cell);
+    }
+
+    foreach (const CellRange &range, rangeMap.value(cell))
+        fileRange(cell, range, false);
+
+    if (ranges.isEmpty()) {
+        rangeMap.remove(cell);
+    } else {
+        rangeMap.insert(cell, ranges);
+        foreach (const CellRange &range, ranges)
+            fileRange(cell, range, true);
+    }
+}
+
+QVector<quint64> DependencyGraph::precedents(quint64 cell) const
+{
+    return precedentMap.value(cell);
+}
+
+QVector<CellRange> DependencyGraph::rangePrecedents(quint64 cell) const
+{
+    return rangeMap.value(cell);
+}
+
+QVector<quint64> DependencyGraph::dependents(quint64 cell) const
+{
+    return dependents(QVector<quint64>() << cell);
+}
+
+bool DependencyGraph::hasDependents(quint64 cell) const
+{
+    if (!dependentMap.value(cell).isEmpty())
+        return true;
+
+    QSet<quint64> ranged;
+    addRangeDependents(cell, &ranged);
+    return !ranged.isEmpty();
+}
+
+// Walks from all the given cells at once, so a cell shared by several
+// of them is reported and expanded only once.
+QVector<quint64> DependencyGraph::dependents(const QVector<quint64> &cells) const
+{
+    QVector<quint64> result;
+    QSet<quint64> visited;
+    QVector<quint64> pending = cells;
+
+    while (!pending.isEmpty()) {
+        quint64 current = pending.last();
+        pending.removeLast();
+
+        QSet<quint64> direct = dependentMap.value(current);
+        addRangeDependents(current, &direct);
+
+        foreach (quint64 dependent, direct) {
+            if (!visited.contains(dependent)) {
+                visited.insert(dependent);
+                result.append(dependent);
+                pending.append(dependent);
+            }
+        }
+    }
+    return result;
+}
+
+void DependencyGraph::clear()
+{
+    precedentMap.clear();
+    dependentMap.clear();
+    rangeMap.clear();
+    rangeBuckets.clear();
+}
+
+int DependencyGraph::bucketLevel(const CellRange &range)
+{
+    int level = 0;
+    int shift = FirstBucketBits;
+    while (level < BucketLevels - 1
+           && (range.bottom >> shift) - (range.top >> shift) > 1) {
+        ++level;
+        shift += LevelBits;
+    }
+    return level;
+}
+
+quint64 DependencyGraph::bucketKey(int level, int bucket, int column)
+{
+    return (quint64(level) << 60) | (quint64(quint32(bucket)) << 32)
+           | quint32(column);
+}
+
+void DependencyGraph::fileRange(quint64 cell, const CellRange &range,
+                                bool add)
+{
+    int level = bucketLevel(range);
+    int shift = FirstBucketBits + level * LevelBits;
+    for (int column = range.left; column <= range.right; ++column) {
+        for (int bucket = range.top >> shift;
+             bucket <= range.bottom >> shift; ++bucket) {
+            quint64 key = bucketKey(level, bucket, column);
+            if (add) {
+                rangeBuckets[key].insert(cell);
+                continue;
+            }
+            QHash<quint64, QSet<quint64> >::iterator i =
+                    rangeBuckets.find(key);
+            if (i != rangeBuckets.end()) {
+                i.value().remove(cell);
+                if (i.value().isEmpty())
+                    rangeBuckets.erase(i);
+            }
+        }
+    }
+}
+
+// Adds the cells with a range precedent that contains `cell`: one
+// bucket is looked at per level.
+void DependencyGraph::addRangeDependents(quint64 cell,
+                                         QSet<quint64> *result) const
+{
+    if (rangeBuckets.isEmpty())
+        return;
+
+    int cellRow = row(cell);
+    int cellColumn = column(cell);
+    for (int level = 0; level < BucketLevels; ++level) {
+        int shift = FirstBucketBits + level * LevelBits;
+        QHash<quint64, QSet<quint64> >::const_iterator i =
+                rangeBuckets.constFind(bucketKey(level, cellRow >> shift,
+                                                 cellColumn));
+        if (i == rangeBuckets.constEnd())
+            continue;
+        foreach (quint64 candidate, i.value()) {
+            if (result->contains(candidate))
+                continue;
+            foreach (const CellRange &range, rangeMap.value(candidate)) {
+                if (range.contains(cellRow, cellColumn)) {
+                    result->insert(candidate);
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef DEPENDENCYGRAPH_H
+#define DEPENDENCYGRAPH_H
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include "cellreference.h"
+
+class DependencyGraph
+{
+public:
+    static quint64 key(int row, int column)
+        { return (quint64(quint32(row)) << 32) | quint32(column); }
+    static int row(quint64 key) { return int(key >> 32); }
+    static int column(quint64 key) { return int(key & 0xffffffff); }
+
+    void setPrecedents(quint64 cell, const QVector<quint64> &precedents,
+                       const QVector<CellRange> &ranges);
+    QVector<quint64> precedents(quint64 cell) const;
+    QVector<CellRange> rangePrecedents(quint64 cell) const;
+    QVector<quint64> dependents(quint64 cell) const;
+    QVector<quint64> dependents(const QVector<quint64> &cells) const;
+    bool hasDependents(quint64 cell) const;
+    void clear();
+
+private:
+    enum { BucketLevels = 6, FirstBucketBits = 6, LevelBits = 3 };
+
+    static int bucketLevel(const CellRange &range);
+    static quint64 bucketKey(int level, int bucket, int column);
+    void fileRange(quint64 cell, const CellRange &range, bool add);
+    void addRangeDependents(quint64 cell, QSet<quint64> *result) const;
+
+    QHash<quint64, QVector<quint64> > precedentMap;
+    QHash<quint64, QSet<quint64> > dependentMap;
+    QHash<quint64, QVector<CellRange> > rangeMap;
+    // Cells with a range precedent, filed under each column the range
+    // spans and the buckets of rows it covers there.  Buckets come in
+    // levels of 64, 512, 4096 ... rows; a range goes to the finest
+    // level at which it touches at most two buckets, so a cell only
+    // meets ranges of about its own neighbourhood.
+    QHash<quint64, QSet<quint64> > rangeBuckets;
+};
+
+#endif // DEPENDENCYGRAPH_H
@@ -0,0 +1,47 @@
+# The calculation engine: everything needed to load, edit, recalculate
+# and save a sheet without any widgets.  Shared by the GUI and the
+# command-line tools.
+
+QT += concurrent
+CONFIG += c++17
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/cell.cpp \
+    $$PWD/formula.cpp \
+    $$PWD/formulapool.cpp \
+    $$PWD/dependencygraph.cpp \
+    $$PWD/cellstore.cpp \
+    $$PWD/sheet.cpp \
+    $$PWD/cellreference.cpp \
+    $$PWD/sheetfile.cpp \
+    $$PWD/value.cpp \
+    $$PWD/stringpool.cpp \
+    $$PWD/csvfile.cpp \
+    $$PWD/searchindex.cpp \
+    $$PWD/rowsorter.cpp \
+    $$PWD/profiler.cpp \
+    $$PWD/undojournal.cpp \
+    $$PWD/lookupcache.cpp \
+    $$PWD/sheetloader.cpp
+
+HEADERS += \
+    $$PWD/cell.h \
+    $$PWD/formula.h \
+    $$PWD/formulapool.h \
+    $$PWD/dependencygraph.h \
+    $$PWD/cellstore.h \
+    $$PWD/sheet.h \
+    $$PWD/cellreference.h \
+    $$PWD/sheetfile.h \
+    $$PWD/value.h \
+    $$PWD/stringpool.h \
+    $$PWD/csvfile.h \
+    $$PWD/searchindex.h \
+    $$PWD/rowsorter.h \
+    $$PWD/profiler.h \
+    $$PWD/undojournal.h \
+    $$PWD/lookupcache.h \
+    $$PWD/sheetloader.h
@@ -1,6 +1,7 @@
 #include <QCheckBox>
 #include <QLabel>
 #include <QLineEdit>
+#include <QListWidget>
 #include <QPushButton>
 #include <QHBoxLayout>
 #include <QVBoxLayout>
@@ -21,12 +22,24 @@ FindDialog::FindDialog(QWidget *parent)
     findButton->setDefault(true);
     findButton->setEnabled(false);
 
+    findAllButton = new QPushButton(tr("Find &All"));
+    findAllButton->setEnabled(false);
+
     closeButton = new QPushButton(tr("Close"));
 
+    resultLabel = new QLabel;
+    resultList = new QListWidget;
+    resultLabel->hide();
+    resultList->hide();
+
     connect(lineEdit, SIGNAL(textChanged(const QString &)),
             this, SLOT(enableFindButton(const QString &)));
     connect(findButton, SIGNAL(clicked()),
             this, SLOT(findClicked()));
+    connect(findAllButton, SIGNAL(clicked()),
+            this, SLOT(findAllClicked()));
+    connect(resultList, SIGNAL(itemActivated(QListWidgetItem *)),
+            this, SLOT(resultActivated(QListWidgetItem *)));
     connect(closeButton, SIGNAL(clicked()),
             this, SLOT(close()));
 
@@ -41,12 +54,18 @@ FindDialog::FindDialog(QWidget *parent)
 
     QVBoxLayout *rightLayout = new QVBoxLayout;
     rightLayout->addWidget(findButton);
+    rightLayout->addWidget(findAllButton);
     rightLayout->addWidget(closeButton);
     rightLayout->addStretch();
 
-    QHBoxLayout *mainLayout = new QHBoxLayout;
-    mainLayout->addLayout(leftLayout);
-    mainLayout->addLayout(rightLayout);
+    QHBoxLayout *topLayout = new QHBoxLayout;
+    topLayout->addLayout(leftLayout);
+    topLayout->addLayout(rightLayout);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+    mainLayout->addLayout(topLayout);
+    mainLayout->addWidget(resultLabel);
+    mainLayout->addWidget(resultList);
     setLayout(mainLayout);
 
     setWindowTitle(tr("Find"));
@@ -66,7 +85,52 @@ void FindDialog::findClicked()
      }
 }
 
+void FindDialog::findAllClicked()
+{
+    Qt::CaseSensitivity cs =
+            caseCheckBox->isChecked() ? Qt::CaseSensitive
+                                      : Qt::CaseInsensitive;
+    emit findAll(lineEdit->text(), cs);
+}
+
+// Lists the matches of a Find All; only the first MaxResults of them
+// are shown, which keeps a search for a common letter responsive.
+void FindDialog::showResults(const QVector<CellReference> &cells,
+                             const QStringList &texts)
+{
+    resultList->clear();
+    int count = qMin(cells.size(), int(MaxResults));
+    for (int i = 0; i < count; ++i) {
+        QListWidgetItem *item = new QListWidgetItem(
+                cells[i].toString() + ": " + texts.at(i), resultList);
+        item->setData(Qt::UserRole, cells[i].row);
+        item->setData(Qt::UserRole + 1, cells[i].column);
+    }
+
+    if (cells.size() > count) {
+        resultLabel->setText(tr("%1 cells found, showing the first %2")
+                             .arg(cells.size()).arg(count));
+    } else {
+        resultLabel->setText(tr("%1 cells found").arg(cells.size()));
+    }
+
+    if (resultList->isHidden()) {
+        setMinimumHeight(0);
+        setMaximumHeight(QWIDGETSIZE_MAX);
+        resultLabel->show();
+        resultList->show();
+        resize(width(), sizeHint().height());
+    }
+}
+
+void FindDialog::resultActivated(QListWidgetItem *item)
+{
+    emit cellActivated(item->data(Qt::UserRole).toInt(),
+                       item->data(Qt::UserRole + 1).toInt());
+}
+
 void FindDialog::enableFindButton(const QString &text)
 {
     findButton->setEnabled(!text.isEmpty());
+    findAllButton->setEnabled(!text.isEmpty());
 }
@@ -2,10 +2,16 @@
 #define FINDDIALOG_H
 
 #include <QDialog>
+#include <QStringList>
+#include <QVector>
+
+#include "cellreference.h"
 
 class QCheckBox;
 class QLabel;
 class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
 class QPushButton;
 
 class FindDialog : public QDialog
@@ -13,13 +19,22 @@ class FindDialog : public QDialog
     Q_OBJECT
 
 public:
+    enum { MaxResults = 10000 };
+
     FindDialog(QWidget *parent = 0);
+
+    void showResults(const QVector<CellReference> &cells,
+                     const QStringList &texts);
 signals:
     void findNext(const QString &str, Qt::CaseSensitivity cs);
     void findPrevious(const QString &str, Qt::CaseSensitivity cs);
+    void findAll(const QString &str, Qt::CaseSensitivity cs);
+    void cellActivated(int row, int column);
 
 private slots:
     void findClicked();
+    void findAllClicked();
+    void resultActivated(QListWidgetItem *item);
     void enableFindButton(const QString &text);
 
 private:
@@ -28,7 +43,10 @@ private:
     QCheckBox   *caseCheckBox;
     QCheckBox   *backwardCheckBox;
     QPushButton *findButton;
+    QPushButton *findAllButton;
     QPushButton *closeButton;
+    QLabel      *resultLabel;
+    QListWidget *resultList;
 };
 
 #endif // FINDDIALOG_H
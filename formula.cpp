@@ -0,0 +1,1100 @@
+#include "formula.h"
+
+#include <QDataStream>
+#include <QStringList>
+#include <QVarLengthArray>
+
+#include <limits>
+
+class FormulaData : public QSharedData
+{
+public:
+    enum Opcode { PushNumber, PushCell, Add, Subtract, Multiply,
+                  Divide, Negate, BeginAggregate, AggregateRange,
+                  AggregateValue, EndAggregate, BeginLookup, LookupRange,
+                  LookupValue, EndLookup };
+
+    enum Function { Sum, Average, Min, Max, Count, VLookup, Match,
+                    XLookup };
+
+    struct Instruction
+    {
+        Opcode op;
+        union {
+            double number;
+            CellReference cell;
+            int function;
+            int range;
+        };
+    };
+
+    FormulaData() : stackDepth(0) {}
+
+    QVector<Instruction> code;
+    QVector<CellRange> ranges;
+    int stackDepth;
+
+    // The text as the literal pieces around its references, which are
+    // offsets like those of the program.  There is always one more
+    // literal than there are references.
+    QStringList literals;
+    QVector<CellReference> offsets;
+    QString key;
+};
+
+typedef FormulaData::Instruction Instruction;
+
+static inline bool isNameChar(QChar ch)
+{
+    return ch.isLetterOrNumber() || ch == '.';
+}
+
+static inline bool isValid(int row, int column)
+{
+    return row >= 0 && row < CellReference::MaxRows
+           && column >= 0 && column < CellReference::MaxColumns;
+}
+
+// Splits formula text into its references, relative to (row, column),
+// and the literal text between them.  A name followed by '(' is a
+// function, not a reference.
+static void splitReferences(const QString &expression, int row, int column,
+                            QStringList *literals,
+                            QVector<CellReference> *offsets)
+{
+    QString literal;
+    int pos = 0;
+    while (pos < expression.size()) {
+        if (!isNameChar(expression[pos])) {
+            literal += expression[pos++];
+            continue;
+        }
+
+        int start = pos;
+        while (pos < expression.size() && isNameChar(expression[pos]))
+            ++pos;
+        QString token = expression.mid(start, pos - start);
+
+        CellReference ref;
+        if ((pos < expression.size() && expression[pos] == '(')
+                || !CellReference::parse(token, &ref)) {
+            literal += token;
+            continue;
+        }
+
+        ref.row -= row;
+        ref.column -= column;
+        literals->append(literal);
+        offsets->append(ref);
+        literal.clear();
+    }
+    literals->append(literal);
+}
+
+// The R1C1 form under which identical programs are shared.  References
+// are set off by a null character so that literal text cannot pass for
+// one.
+static QString relativeKey(const QStringList &literals,
+                           const QVector<CellReference> &offsets)
+{
+    QString key = literals.first();
+    for (int i = 0; i < offsets.size(); ++i) {
+        key += QChar::Null;
+        key += QString("R[%1]C[%2]").arg(offsets[i].row)
+                                    .arg(offsets[i].column);
+        key += literals.at(i + 1);
+    }
+    return key;
+}
+
+static bool translate(const CellRange &offsets, int row, int column,
+                      CellRange *range)
+{
+    range->top = row + offsets.top;
+    range->left = column + offsets.left;
+    range->bottom = row + offsets.bottom;
+    range->right = column + offsets.right;
+    return isValid(range->top, range->left)
+           && isValid(range->bottom, range->right);
+}
+
+static int functionIndex(const QString &name)
+{
+    static const char * const names[] = {
+        "SUM", "AVERAGE", "MIN", "MAX", "COUNT", "VLOOKUP", "MATCH",
+        "XLOOKUP"
+    };
+
+    QString upper = name.toUpper();
+    for (int i = 0; i < int(sizeof(names) / sizeof(names[0])); ++i) {
+        if (upper == QLatin1String(names[i]))
+            return i;
+    }
+    return -1;
+}
+
+RangeSummary::RangeSummary()
+    : sum(0.0), min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity()), count(0)
+{
+}
+
+class Formula::Compiler
+{
+public:
+    typedef FormulaData::Opcode Opcode;
+
+    Compiler(const QString &expr, FormulaData *target);
+
+    bool compile();
+
+private:
+    void compileExpression();
+    void compileTerm();
+    void compileFactor();
+    void compileCall(const QString &name);
+    void compileArgument();
+    void compileLookup(int function);
+    bool parseRange(CellRange *range);
+    QString readToken();
+    void append(Opcode op, int stackEffect = -1);
+    void append(const Instruction &instruction, int stackEffect);
+    void pushNumber(double number);
+    void pushCell(int row, int column);
+
+    const QString &str;
+    int pos;
+    int depth;
+    int maxDepth;
+    bool ok;
+    FormulaData *formula;
+};
+
+Formula::Compiler::Compiler(const QString &expr, FormulaData *target)
+    : str(expr), pos(0), depth(0), maxDepth(0), ok(true), formula(target)
+{
+}
+
+bool Formula::Compiler::compile()
+{
+    compileExpression();
+    if (str[pos] != QChar::Null)
+        ok = false;
+    formula->stackDepth = maxDepth;
+    return ok;
+}
+
+void Formula::Compiler::compileExpression()
+{
+    compileTerm();
+    while (str[pos] == '+' || str[pos] == '-') {
+        Opcode op = (str[pos] == '+') ? FormulaData::Add
+                                      : FormulaData::Subtract;
+        ++pos;
+
+        compileTerm();
+        append(op);
+    }
+}
+
+void Formula::Compiler::compileTerm()
+{
+    compileFactor();
+    while (str[pos] == '*' || str[pos] == '/') {
+        Opcode op = (str[pos] == '*') ? FormulaData::Multiply
+                                      : FormulaData::Divide;
+        ++pos;
+
+        compileFactor();
+        append(op);
+    }
+}
+
+void Formula::Compiler::compileFactor()
+{
+    bool negative = false;
+
+    if (str[pos] == '-') {
+        negative = true;
+        ++pos;
+    }
+
+    if (str[pos] == '(') {
+        ++pos;
+        compileExpression();
+        if (str[pos] == ')') {
+            ++pos;
+        } else {
+            ok = false;
+        }
+    } else {
+        QString token = readToken();
+
+        CellReference ref;
+        if (str[pos] == '(') {
+            compileCall(token);
+        } else if (CellReference::parse(token, &ref)) {
+            // A range is only meaningful as a function argument.
+            if (str[pos] == ':')
+                ok = false;
+            pushCell(ref.row, ref.column);
+        } else {
+            bool isNumber;
+            double number = token.toDouble(&isNumber);
+            if (!isNumber)
+                ok = false;
+            pushNumber(number);
+        }
+    }
+
+    if (negative)
+        append(FormulaData::Negate, 0);
+}
+
+void Formula::Compiler::compileCall(const QString &name)
+{
+    Instruction instruction;
+    instruction.op = FormulaData::BeginAggregate;
+    instruction.function = functionIndex(name);
+    if (instruction.function >= FormulaData::VLookup) {
+        compileLookup(instruction.function);
+        return;
+    }
+    if (instruction.function < 0)
+        ok = false;
+    append(instruction, 0);
+
+    ++pos;
+    if (str[pos] != ')') {
+        compileArgument();
+        while (str[pos] == ',') {
+            ++pos;
+            compileArgument();
+        }
+    }
+
+    if (str[pos] == ')') {
+        ++pos;
+    } else {
+        ok = false;
+    }
+    append(FormulaData::EndAggregate, 1);
+}
+
+void Formula::Compiler::compileArgument()
+{
+    CellRange range;
+    if (parseRange(&range)) {
+        Instruction instruction;
+        instruction.op = FormulaData::AggregateRange;
+        instruction.range = formula->ranges.size();
+        formula->ranges.append(range);
+        append(instruction, 0);
+    } else {
+        compileExpression();
+        append(FormulaData::AggregateValue);
+    }
+}
+
+// The lookup functions take their tables as ranges in fixed places:
+//
+//   VLOOKUP(key, table, column[, sorted])
+//   MATCH(key, range[, type])
+//   XLOOKUP(key, keys, results[, notFound])
+//
+// Ranges and values are collected separately and told apart by their
+// order when the lookup is evaluated.
+void Formula::Compiler::compileLookup(int function)
+{
+    static const struct {
+        int minArgs;
+        int maxArgs;
+        int ranges;
+    } signatures[] = {
+        { 3, 4, 0x2 },
+        { 2, 3, 0x2 },
+        { 3, 4, 0x6 }
+    };
+    const int minArgs = signatures[function - FormulaData::VLookup].minArgs;
+    const int maxArgs = signatures[function - FormulaData::VLookup].maxArgs;
+    const int ranges = signatures[function - FormulaData::VLookup].ranges;
+
+    Instruction instruction;
+    instruction.op = FormulaData::BeginLookup;
+    instruction.function = function;
+    append(instruction, 0);
+
+    ++pos;
+    int args = 0;
+    if (str[pos] != ')') {
+        for (;;) {
+            // Past the last argument there is no bit to test.
+            if (args == maxArgs) {
+                ok = false;
+                break;
+            }
+            CellRange range;
+            if (!(ranges & (1 << args))) {
+                compileExpression();
+                append(FormulaData::LookupValue);
+            } else if (parseRange(&range)) {
+                instruction.op = FormulaData::LookupRange;
+                instruction.range = formula->ranges.size();
+                formula->ranges.append(range);
+                append(instruction, 0);
+            } else {
+                ok = false;
+            }
+            ++args;
+            if (str[pos] != ',' || !ok)
+                break;
+            ++pos;
+        }
+    }
+    if (args < minArgs)
+        ok = false;
+
+    if (str[pos] == ')') {
+        ++pos;
+    } else {
+        ok = false;
+    }
+    append(FormulaData::EndLookup, 1);
+}
+
+bool Formula::Compiler::parseRange(CellRange *range)
+{
+    int start = pos;
+    CellReference from;
+    CellReference to;
+
+    if (CellReference::parse(readToken(), &from) && str[pos] == ':') {
+        ++pos;
+        if (CellReference::parse(readToken(), &to)) {
+            range->top = qMin(from.row, to.row);
+            range->left = qMin(from.column, to.column);
+            range->bottom = qMax(from.row, to.row);
+            range->right = qMax(from.column, to.column);
+            return true;
+        }
+    }
+    pos = start;
+    return false;
+}
+
+QString Formula::Compiler::readToken()
+{
+    int start = pos;
+    while (str[pos].isLetterOrNumber() || str[pos] == '.')
+        ++pos;
+    return str.mid(start, pos - start);
+}
+
+void Formula::Compiler::append(Opcode op, int stackEffect)
+{
+    Instruction instruction;
+    instruction.op = op;
+    instruction.number = 0.0;
+    append(instruction, stackEffect);
+}
+
+void Formula::Compiler::append(const Instruction &instruction,
+                               int stackEffect)
+{
+    formula->code.append(instruction);
+
+    depth += stackEffect;
+    maxDepth = qMax(maxDepth, depth);
+}
+
+void Formula::Compiler::pushNumber(double number)
+{
+    Instruction instruction;
+    instruction.op = FormulaData::PushNumber;
+    instruction.number = number;
+    append(instruction, 1);
+}
+
+void Formula::Compiler::pushCell(int row, int column)
+{
+    Instruction instruction;
+    instruction.op = FormulaData::PushCell;
+    instruction.cell.row = row;
+    instruction.cell.column = column;
+    append(instruction, 1);
+}
+
+Formula::Formula()
+{
+}
+
+Formula::Formula(const Formula &other)
+    : d(other.d)
+{
+}
+
+Formula::~Formula()
+{
+}
+
+Formula &Formula::operator=(const Formula &other)
+{
+    d = other.d;
+    return *this;
+}
+
+// Compiles the formula of the cell at (row, column).  The program and
+// the text it is shown as are both relative to that cell.
+Formula Formula::compile(const QString &expression, int row, int column)
+{
+    Formula formula;
+    formula.d = new FormulaData;
+    FormulaData *data = formula.d.data();
+
+    splitReferences(expression, row, column, &data->literals,
+                    &data->offsets);
+    data->key = relativeKey(data->literals, data->offsets);
+
+    QString expr = expression;
+    expr.replace(" ", "");
+    expr.append(QChar::Null);
+
+    Compiler compiler(expr, data);
+    if (!compiler.compile()) {
+        data->code.clear();
+        data->ranges.clear();
+        return formula;
+    }
+
+    for (int i = 0; i < data->code.size(); ++i) {
+        if (data->code[i].op == FormulaData::PushCell) {
+            data->code[i].cell.row -= row;
+            data->code[i].cell.column -= column;
+        }
+    }
+    for (int i = 0; i < data->ranges.size(); ++i) {
+        CellRange &range = data->ranges[i];
+        range.top -= row;
+        range.left -= column;
+        range.bottom -= row;
+        range.right -= column;
+    }
+    return formula;
+}
+
+QString Formula::relativeForm(const QString &expression, int row,
+                              int column)
+{
+    QStringList literals;
+    QVector<CellReference> offsets;
+    splitReferences(expression, row, column, &literals, &offsets);
+    return relativeKey(literals, offsets);
+}
+
+bool Formula::isShared() const
+{
+    return d && d->ref.loadAcquire() > 1;
+}
+
+QString Formula::relativeForm() const
+{
+    return d ? d->key : QString();
+}
+
+// Rebuilds the text of the formula as it reads in the cell at (row,
+// column).  References that fall off the sheet read #REF!.
+QString Formula::toString(int row, int column) const
+{
+    if (!d)
+        return QString();
+
+    QString text = d->literals.value(0);
+    for (int i = 0; i < d->offsets.size(); ++i) {
+        CellReference ref = { row + d->offsets[i].row,
+                              column + d->offsets[i].column };
+        if (isValid(ref.row, ref.column)) {
+            text += ref.toString();
+        } else {
+            text += Value::errorText(Value::BadReference);
+        }
+        text += d->literals.value(i + 1);
+    }
+    return text;
+}
+
+// Rewrites a formula that moves from one row to another together with
+// the columns left to right of its row, as in a sort.  References into
+// the moved part of the row follow it; everything else, including a
+// range that reaches outside it, keeps pointing where it did.
+QString Formula::moveRow(const QString &formula, int fromRow, int toRow,
+                         int left, int right)
+{
+    QString result;
+    result.reserve(formula.size() + 8);
+
+    int pos = 0;
+    while (pos < formula.size()) {
+        if (!formula[pos].isLetterOrNumber() && formula[pos] != '.') {
+            result += formula[pos++];
+            continue;
+        }
+
+        int start = pos;
+        while (pos < formula.size()
+               && (formula[pos].isLetterOrNumber() || formula[pos] == '.'))
+            ++pos;
+        QString token = formula.mid(start, pos - start);
+
+        CellReference ref;
+        if ((pos < formula.size() && formula[pos] == '(')
+                || !CellReference::parse(token, &ref)) {
+            result += token;
+            continue;
+        }
+
+        bool moves = ref.row == fromRow && ref.column >= left
+                && ref.column <= right;
+
+        CellReference to;
+        QString toToken;
+        if (pos < formula.size() && formula[pos] == ':') {
+            int end = pos + 1;
+            while (end < formula.size()
+                   && (formula[end].isLetterOrNumber() || formula[end] == '.'))
+                ++end;
+            toToken = formula.mid(pos + 1, end - pos - 1);
+            if (CellReference::parse(toToken, &to)) {
+                moves = moves && to.row == fromRow && to.column >= left
+                        && to.column <= right;
+                pos = end;
+            } else {
+                toToken.clear();
+            }
+        }
+
+        if (!moves) {
+            result += token;
+            if (!toToken.isEmpty())
+                result += ':' + toToken;
+            continue;
+        }
+
+        ref.row = toRow;
+        result += ref.toString();
+        if (!toToken.isEmpty()) {
+            to.row = toRow;
+            result += ':' + to.toString();
+        }
+    }
+    return result;
+}
+
+// The bytecode is the compiled program in a portable form, so that a
+// saved sheet can be loaded without parsing any formula text.  It
+// starts with the text's literals and references, which are kept even
+// when the formula did not compile.
+QByteArray Formula::bytecode() const
+{
+    QByteArray data;
+    if (!d)
+        return data;
+
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_8);
+    out << d->literals << quint32(d->offsets.size());
+    foreach (const CellReference &offset, d->offsets)
+        out << qint32(offset.row) << qint32(offset.column);
+
+    out << qint32(d->stackDepth) << quint32(d->code.size());
+    foreach (const Instruction &instruction, d->code) {
+        out << quint8(instruction.op);
+        switch (instruction.op) {
+        case FormulaData::PushNumber:
+            out << instruction.number;
+            break;
+        case FormulaData::PushCell:
+            out << qint32(instruction.cell.row)
+                << qint32(instruction.cell.column);
+            break;
+        case FormulaData::BeginAggregate:
+        case FormulaData::BeginLookup:
+            out << qint32(instruction.function);
+            break;
+        case FormulaData::AggregateRange:
+        case FormulaData::LookupRange:
+            out << qint32(instruction.range);
+            break;
+        default:
+            break;
+        }
+    }
+
+    out << quint32(d->ranges.size());
+    foreach (const CellRange &range, d->ranges)
+        out << qint32(range.top) << qint32(range.left)
+            << qint32(range.bottom) << qint32(range.right);
+    return data;
+}
+
+Formula Formula::fromBytecode(const QByteArray &bytecode)
+{
+    Formula formula;
+    if (bytecode.isEmpty())
+        return formula;
+    formula.d = new FormulaData;
+
+    QDataStream in(bytecode);
+    in.setVersion(QDataStream::Qt_5_8);
+
+    QStringList literals;
+    quint32 offsetCount;
+    in >> literals >> offsetCount;
+    if (in.status() != QDataStream::Ok
+            || literals.size() != qint64(offsetCount) + 1)
+        return Formula();
+
+    QVector<CellReference> offsets(offsetCount);
+    for (quint32 i = 0; i < offsetCount; ++i) {
+        qint32 row, column;
+        in >> row >> column;
+        offsets[i].row = row;
+        offsets[i].column = column;
+    }
+    if (in.status() != QDataStream::Ok)
+        return Formula();
+    formula.d->literals = literals;
+    formula.d->offsets = offsets;
+    formula.d->key = relativeKey(literals, offsets);
+
+    qint32 stackDepth;
+    quint32 size;
+    in >> stackDepth >> size;
+    if (in.status() != QDataStream::Ok || size > quint32(bytecode.size()))
+        return formula;
+
+    QVector<Instruction> code(size);
+    for (quint32 i = 0; i < size; ++i) {
+        Instruction &instruction = code[i];
+        quint8 op;
+        qint32 a;
+        qint32 b;
+        in >> op;
+        instruction.op = FormulaData::Opcode(op);
+        instruction.number = 0.0;
+        switch (op) {
+        case FormulaData::PushNumber:
+            in >> instruction.number;
+            break;
+        case FormulaData::PushCell:
+            in >> a >> b;
+            instruction.cell.row = a;
+            instruction.cell.column = b;
+            break;
+        case FormulaData::BeginAggregate:
+        case FormulaData::BeginLookup:
+            in >> a;
+            instruction.function = a;
+            break;
+        case FormulaData::AggregateRange:
+        case FormulaData::LookupRange:
+            in >> a;
+            instruction.range = a;
+            break;
+        default:
+            if (op > FormulaData::EndLookup)
+                return formula;
+            break;
+        }
+    }
+
+    quint32 rangeCount;
+    in >> rangeCount;
+    if (in.status() != QDataStream::Ok
+            || rangeCount > quint32(bytecode.size()))
+        return formula;
+
+    QVector<CellRange> ranges(rangeCount);
+    for (quint32 i = 0; i < rangeCount; ++i) {
+        qint32 top, left, bottom, right;
+        in >> top >> left >> bottom >> right;
+        CellRange range = { top, left, bottom, right };
+        ranges[i] = range;
+    }
+    if (in.status() != QDataStream::Ok)
+        return formula;
+
+    // A corrupt program evaluates to an error rather than crashing, so
+    // check that it never underflows or outgrows its stack.
+    int depth = 0;
+    int maxDepth = 0;
+    int aggregates = 0;
+    int lookups = 0;
+    foreach (const Instruction &instruction, code) {
+        switch (instruction.op) {
+        case FormulaData::PushNumber:
+        case FormulaData::PushCell:
+            ++depth;
+            break;
+        case FormulaData::Negate:
+            if (depth < 1)
+                return formula;
+            break;
+        case FormulaData::BeginAggregate:
+            ++aggregates;
+            break;
+        case FormulaData::AggregateRange:
+            if (aggregates < 1 || instruction.range < 0
+                    || instruction.range >= ranges.size())
+                return formula;
+            break;
+        case FormulaData::AggregateValue:
+            if (aggregates < 1 || depth < 1)
+                return formula;
+            --depth;
+            break;
+        case FormulaData::EndAggregate:
+            if (aggregates < 1)
+                return formula;
+            --aggregates;
+            ++depth;
+            break;
+        case FormulaData::BeginLookup:
+            if (instruction.function < FormulaData::VLookup
+                    || instruction.function > FormulaData::XLookup)
+                return formula;
+            ++lookups;
+            break;
+        case FormulaData::LookupRange:
+            if (lookups < 1 || instruction.range < 0
+                    || instruction.range >= ranges.size())
+                return formula;
+            break;
+        case FormulaData::LookupValue:
+            if (lookups < 1 || depth < 1)
+                return formula;
+            --depth;
+            break;
+        case FormulaData::EndLookup:
+            if (lookups < 1)
+                return formula;
+            --lookups;
+            ++depth;
+            break;
+        default:
+            if (depth < 2)
+                return formula;
+            --depth;
+            break;
+        }
+        maxDepth = qMax(maxDepth, depth);
+    }
+    if (depth != 1 || aggregates != 0 || lookups != 0)
+        return formula;
+
+    // The stored depth is not trusted to size the evaluation stack.
+    formula.d->stackDepth = maxDepth;
+    formula.d->code = code;
+    formula.d->ranges = ranges;
+    return formula;
+}
+
+// The cells and ranges read by the formula in the cell at (row,
+// column).  References that fall off the sheet are left out; they
+// evaluate to #REF! without reading anything.
+QVector<CellReference> Formula::references(int row, int column) const
+{
+    QVector<CellReference> refs;
+    if (d) {
+        foreach (const Instruction &instruction, d->code) {
+            if (instruction.op != FormulaData::PushCell)
+                continue;
+            CellReference ref = { row + instruction.cell.row,
+                                  column + instruction.cell.column };
+            if (isValid(ref.row, ref.column))
+                refs.append(ref);
+        }
+    }
+    return refs;
+}
+
+QVector<CellRange> Formula::ranges(int row, int column) const
+{
+    QVector<CellRange> result;
+    if (d) {
+        foreach (const CellRange &offsets, d->ranges) {
+            CellRange range;
+            if (translate(offsets, row, column, &range))
+                result.append(range);
+        }
+    }
+    return result;
+}
+
+struct Aggregate
+{
+    int function;
+    RangeSummary summary;
+};
+
+static void accumulate(Aggregate *aggregate, const RangeSummary &summary)
+{
+    RangeSummary &total = aggregate->summary;
+    total.sum += summary.sum;
+    total.min = qMin(total.min, summary.min);
+    total.max = qMax(total.max, summary.max);
+    total.count += summary.count;
+    if (summary.error.isError() && !total.error.isError())
+        total.error = summary.error;
+}
+
+static void accumulate(Aggregate *aggregate, const Value &value)
+{
+    RangeSummary summary;
+    double number;
+    if (value.toNumber(&number)) {
+        summary.sum = summary.min = summary.max = number;
+        summary.count = 1;
+    } else if (value.isError()) {
+        summary.error = value;
+    } else {
+        summary.error = Value::fromError(Value::WrongType);
+    }
+    accumulate(aggregate, summary);
+}
+
+static Value result(const Aggregate &aggregate)
+{
+    const RangeSummary &summary = aggregate.summary;
+
+    // COUNT only counts numbers; everything else propagates errors.
+    if (aggregate.function == FormulaData::Count)
+        return Value::fromNumber(summary.count);
+    if (summary.error.isError())
+        return summary.error;
+
+    switch (aggregate.function) {
+    case FormulaData::Sum:
+        return Value::fromNumber(summary.sum);
+    case FormulaData::Average:
+        if (summary.count == 0)
+            return Value::fromError(Value::DivideByZero);
+        return Value::fromNumber(summary.sum / summary.count);
+    case FormulaData::Min:
+        return Value::fromNumber(summary.count ? summary.min : 0.0);
+    default:
+        return Value::fromNumber(summary.count ? summary.max : 0.0);
+    }
+}
+
+struct Lookup
+{
+    enum { MaxRanges = 2, MaxValues = 3 };
+
+    int function;
+    int rangeCount;
+    int valueCount;
+    bool badReference;
+    CellRange ranges[MaxRanges];
+    Value values[MaxValues];
+};
+
+static inline bool isLine(const CellRange &range)
+{
+    return range.top == range.bottom || range.left == range.right;
+}
+
+static bool toInteger(const Value &value, int *integer)
+{
+    double number;
+    if (!value.toNumber(&number) || number < -2147483647.0
+            || number > 2147483647.0)
+        return false;
+    *integer = int(number);
+    return true;
+}
+
+static Value result(const FormulaContext &context, const Lookup &lookup)
+{
+    const int required = lookup.function == FormulaData::XLookup ? 2 : 1;
+    if (lookup.badReference)
+        return Value::fromError(Value::BadReference);
+    if (lookup.rangeCount < required || lookup.valueCount < 1)
+        return Value::fromError(Value::WrongType);
+
+    const Value &key = lookup.values[0];
+    if (key.isError())
+        return key;
+
+    switch (lookup.function) {
+    case FormulaData::VLookup: {
+        // Searches the first column of the table, sorted by default.
+        const CellRange &table = lookup.ranges[0];
+        int column;
+        bool sorted = true;
+        if (lookup.valueCount < 2 || !toInteger(lookup.values[1], &column)
+                || column < 1)
+            return Value::fromError(Value::WrongType);
+        if (column > table.right - table.left + 1)
+            return Value::fromError(Value::BadReference);
+        if (lookup.valueCount > 2) {
+            double flag;
+            if (!lookup.values[2].toNumber(&flag))
+                return Value::fromError(Value::WrongType);
+            sorted = flag != 0.0;
+        }
+
+        CellRange keys = { table.top, table.left, table.bottom, table.left };
+        int offset = context.find(keys, key, sorted);
+        if (offset < 0)
+            return Value::fromError(Value::NotAvailable);
+        return context.cellValue(table.top + offset,
+                                 table.left + column - 1);
+    }
+    case FormulaData::Match: {
+        // Only exact (0) and ascending (1, the default) matches.
+        int type = 1;
+        if (lookup.valueCount > 1
+                && (!toInteger(lookup.values[1], &type) || type < 0))
+            return Value::fromError(Value::WrongType);
+        if (!isLine(lookup.ranges[0]))
+            return Value::fromError(Value::NotAvailable);
+
+        int offset = context.find(lookup.ranges[0], key, type > 0);
+        if (offset < 0)
+            return Value::fromError(Value::NotAvailable);
+        return Value::fromNumber(offset + 1);
+    }
+    default: {
+        const CellRange &keys = lookup.ranges[0];
+        const CellRange &results = lookup.ranges[1];
+        if (!isLine(keys) || !isLine(results))
+            return Value::fromError(Value::WrongType);
+
+        int offset = context.find(keys, key, false);
+        if (offset < 0) {
+            if (lookup.valueCount > 1)
+                return lookup.values[1];
+            return Value::fromError(Value::NotAvailable);
+        }
+        if (keys.left == keys.right) {
+            if (offset > results.bottom - results.top)
+                return Value::fromError(Value::NotAvailable);
+            return context.cellValue(results.top + offset, results.left);
+        }
+        if (offset > results.right - results.left)
+            return Value::fromError(Value::NotAvailable);
+        return context.cellValue(results.top, results.left + offset);
+    }
+    }
+}
+
+Value Formula::evaluate(const FormulaContext &context, int row,
+                        int column) const
+{
+    if (!d || d->code.isEmpty())
+        return Value::fromError(Value::ParseError);
+
+    QVarLengthArray<Value, 16> stack(d->stackDepth);
+    QVarLengthArray<Aggregate, 4> aggregates;
+    QVarLengthArray<Lookup, 2> lookups;
+    int top = -1;
+
+    const Instruction *ip = d->code.constData();
+    const Instruction *end = ip + d->code.size();
+    for (; ip != end; ++ip) {
+        switch (ip->op) {
+        case FormulaData::PushNumber:
+            stack[++top] = Value::fromNumber(ip->number);
+            break;
+        case FormulaData::PushCell:
+            stack[++top] = context.cellValue(row + ip->cell.row,
+                                             column + ip->cell.column);
+            break;
+        case FormulaData::Negate: {
+            double x;
+            if (stack[top].toNumber(&x)) {
+                stack[top] = Value::fromNumber(-x);
+            } else if (!stack[top].isError()) {
+                stack[top] = Value::fromError(Value::WrongType);
+            }
+            break;
+        }
+        case FormulaData::BeginAggregate: {
+            Aggregate aggregate;
+            aggregate.function = ip->function;
+            aggregates.append(aggregate);
+            break;
+        }
+        case FormulaData::AggregateRange: {
+            CellRange range;
+            if (translate(d->ranges.at(ip->range), row, column, &range)) {
+                accumulate(&aggregates.last(), context.summarize(range));
+            } else {
+                accumulate(&aggregates.last(),
+                           Value::fromError(Value::BadReference));
+            }
+            break;
+        }
+        case FormulaData::AggregateValue:
+            accumulate(&aggregates.last(), stack[top--]);
+            break;
+        case FormulaData::EndAggregate:
+            stack[++top] = result(aggregates.last());
+            aggregates.removeLast();
+            break;
+        case FormulaData::BeginLookup: {
+            Lookup lookup;
+            lookup.function = ip->function;
+            lookup.rangeCount = 0;
+            lookup.valueCount = 0;
+            lookup.badReference = false;
+            lookups.append(lookup);
+            break;
+        }
+        case FormulaData::LookupRange: {
+            Lookup &lookup = lookups.last();
+            if (lookup.rangeCount < Lookup::MaxRanges) {
+                CellRange &range = lookup.ranges[lookup.rangeCount++];
+                if (!translate(d->ranges.at(ip->range), row, column, &range))
+                    lookup.badReference = true;
+            }
+            break;
+        }
+        case FormulaData::LookupValue: {
+            Lookup &lookup = lookups.last();
+            if (lookup.valueCount < Lookup::MaxValues)
+                lookup.values[lookup.valueCount++] = stack[top];
+            --top;
+            break;
+        }
+        case FormulaData::EndLookup:
+            stack[++top] = result(context, lookups.last());
+            lookups.removeLast();
+            break;
+        default: {
+            const Value rhs = stack[top--];
+            Value &lhs = stack[top];
+            double x;
+            double y;
+            if (lhs.isError()) {
+                // The left error wins, as in other spreadsheets.
+            } else if (rhs.isError()) {
+                lhs = rhs;
+            } else if (!lhs.toNumber(&x) || !rhs.toNumber(&y)) {
+                lhs = Value::fromError(Value::WrongType);
+            } else if (ip->op == FormulaData::Add) {
+                lhs = Value::fromNumber(x + y);
+            } else if (ip->op == FormulaData::Subtract) {
+                lhs = Value::fromNumber(x - y);
+            } else if (ip->op == FormulaData::Multiply) {
+                lhs = Value::fromNumber(x * y);
+            } else if (y == 0.0) {
+                lhs = Value::fromError(Value::DivideByZero);
+            } else {
+                lhs = Value::fromNumber(x / y);
+            }
+        }
+        }
+    }
+    return stack[0];
+}
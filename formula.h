@@ -0,0 +1,71 @@
+#ifndef FORMULA_H
+#define FORMULA_H
+
+#include <QByteArray>
+#include <QSharedDataPointer>
+#include <QString>
+#include <QVector>
+
+#include "cellreference.h"
+#include "value.h"
+
+struct RangeSummary
+{
+    RangeSummary();
+
+    double sum;
+    double min;
+    double max;
+    int count;
+    Value error;
+};
+
+class FormulaContext
+{
+public:
+    virtual ~FormulaContext() {}
+    virtual Value cellValue(int row, int column) const = 0;
+    virtual RangeSummary summarize(const CellRange &range) const = 0;
+    // The offset of key in a one-row or one-column range, or -1; see
+    // LookupCache::find().
+    virtual int find(const CellRange &range, const Value &key,
+                     bool sorted) const = 0;
+};
+
+class FormulaData;
+
+// A compiled formula.  References are kept as offsets from the cell
+// that holds the formula, in the manner of R1C1 notation, so a formula
+// filled down a column is the same program in every row; the cell's
+// position is passed in wherever it matters.
+class Formula
+{
+public:
+    Formula();
+    Formula(const Formula &other);
+    ~Formula();
+    Formula &operator=(const Formula &other);
+
+    static Formula compile(const QString &expression, int row, int column);
+    static Formula fromBytecode(const QByteArray &bytecode);
+    static QString relativeForm(const QString &expression, int row,
+                                int column);
+    static QString moveRow(const QString &formula, int fromRow, int toRow,
+                           int left, int right);
+
+    bool isNull() const { return !d; }
+    bool isShared() const;
+    QString relativeForm() const;
+    QString toString(int row, int column) const;
+    QVector<CellReference> references(int row, int column) const;
+    QVector<CellRange> ranges(int row, int column) const;
+    QByteArray bytecode() const;
+    Value evaluate(const FormulaContext &context, int row, int column) const;
+
+private:
+    class Compiler;
+
+    QSharedDataPointer<FormulaData> d;
+};
+
+#endif // FORMULA_H
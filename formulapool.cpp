@@ -0,0 +1,53 @@
+#include "formulapool.h"
+
+FormulaPool::FormulaPool()
+    : pruneLimit(MinPruneLimit)
+{
+}
+
+Formula FormulaPool::compile(const QString &expression, int row,
+                             int column)
+{
+    QHash<QString, Formula>::const_iterator i =
+            programs.constFind(Formula::relativeForm(expression, row, column));
+    if (i != programs.constEnd())
+        return i.value();
+    return insert(Formula::compile(expression, row, column));
+}
+
+// Returns the pooled program equal to `formula`, adding it if there is
+// none yet.
+Formula FormulaPool::insert(const Formula &formula)
+{
+    if (formula.isNull())
+        return formula;
+
+    QString key = formula.relativeForm();
+    QHash<QString, Formula>::const_iterator i = programs.constFind(key);
+    if (i != programs.constEnd())
+        return i.value();
+
+    if (programs.size() >= pruneLimit)
+        prune();
+    programs.insert(key, formula);
+    return formula;
+}
+
+void FormulaPool::clear()
+{
+    programs.clear();
+    pruneLimit = MinPruneLimit;
+}
+
+void FormulaPool::prune()
+{
+    QHash<QString, Formula>::iterator i = programs.begin();
+    while (i != programs.end()) {
+        if (i.value().isShared()) {
+            ++i;
+        } else {
+            i = programs.erase(i);
+        }
+    }
+    pruneLimit = qMax(int(MinPruneLimit), 2 * programs.size());
+}
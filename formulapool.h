@@ -0,0 +1,32 @@
+#ifndef FORMULAPOOL_H
+#define FORMULAPOOL_H
+
+#include <QHash>
+#include <QString>
+
+#include "formula.h"
+
+// Shares compiled formulas between the cells of a sheet.  Formulas are
+// compiled relative to their cell, so every cell of a filled range gets
+// the same program and only the first one is parsed.  Programs no cell
+// holds any more are dropped whenever the pool has doubled in size.
+class FormulaPool
+{
+public:
+    enum { MinPruneLimit = 1024 };
+
+    FormulaPool();
+
+    Formula compile(const QString &expression, int row, int column);
+    Formula insert(const Formula &formula);
+    int count() const { return programs.size(); }
+    void clear();
+
+private:
+    void prune();
+
+    QHash<QString, Formula> programs;
+    int pruneLimit;
+};
+
+#endif // FORMULAPOOL_H
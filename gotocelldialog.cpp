@@ -1,3 +1,4 @@
+#include "cellreference.h"
 #include "gotocelldialog.h"
 
 GoToCellDialog::GoToCellDialog(QWidget *parent)
@@ -5,7 +6,7 @@ GoToCellDialog::GoToCellDialog(QWidget *parent)
 {
     setupUi(this);
 
-    QRegExp regExp("[A-Za-z][1-9][0-9]{0,2}");
+    QRegExp regExp("[A-Za-z]{1,3}[1-9][0-9]{0,6}");
     lineEdit->setValidator(new QRegExpValidator(regExp, this));
 
     connect(okButton, SIGNAL(clicked()), this, SLOT(accept()));
@@ -14,5 +15,7 @@ GoToCellDialog::GoToCellDialog(QWidget *parent)
 
 void GoToCellDialog::on_lineEdit_textChanged()
 {
-    okButton->setEnabled(lineEdit->hasAcceptableInput());
+    CellReference ref;
+    okButton->setEnabled(lineEdit->hasAcceptableInput()
+                         && CellReference::parse(lineEdit->text(), &ref));
 }
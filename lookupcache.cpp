@@ -0,0 +1,343 @@
+#include "lookupcache.h"
+#include "cellstore.h"
+#include "dependencygraph.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+namespace {
+
+inline bool isColumn(const CellRange &range)
+{
+    return range.left == range.right;
+}
+
+inline int length(const CellRange &range)
+{
+    return isColumn(range) ? range.bottom - range.top + 1
+                           : range.right - range.left + 1;
+}
+
+inline Value valueAt(const CellStore &store, const CellRange &range,
+                     int offset)
+{
+    const Cell *cell = isColumn(range)
+            ? store.cell(range.top + offset, range.left)
+            : store.cell(range.top, range.left + offset);
+    return cell ? cell->value() : Value();
+}
+
+// Strings match regardless of case, and 0 and -0 are the same number.
+inline QString folded(const CellStore &store, const Value &value)
+{
+    return store.strings().string(value.stringId()).toCaseFolded();
+}
+
+inline double normalized(double number)
+{
+    return number == 0.0 ? 0.0 : number;
+}
+
+const quint64 RowBit = Q_UINT64_C(1) << 32;
+
+// The first position of key within [first, last] in a list of (value,
+// position) pairs sorted by value and then position, or -1.
+template <typename T>
+int firstPosition(const QVector<QPair<T, int> > &entries, const T &key,
+                  int first, int last)
+{
+    typename QVector<QPair<T, int> >::const_iterator i =
+            std::lower_bound(entries.constBegin(), entries.constEnd(),
+                             qMakePair(key, first));
+    if (i == entries.constEnd() || !(i->first == key) || i->second > last)
+        return -1;
+    return i->second;
+}
+
+int firstPosition(const QVector<int> &positions, int first, int last)
+{
+    QVector<int>::const_iterator i =
+            std::lower_bound(positions.constBegin(), positions.constEnd(),
+                             first);
+    if (i == positions.constEnd() || *i > last)
+        return -1;
+    return *i;
+}
+
+// Binary searches the entries of a block that lie within [first,
+// last] for the last one not greater than key.  Returns -1 with
+// *before set when all of them are greater, so that the search goes
+// on in the previous block, or when there are none.
+template <typename T>
+int floorPosition(const QVector<int> &positions, const QVector<T> &values,
+                  const T &key, int first, int last, bool *before)
+{
+    int lo = int(std::lower_bound(positions.constBegin(),
+                                  positions.constEnd(), first)
+                 - positions.constBegin());
+    int hi = int(std::upper_bound(positions.constBegin(),
+                                  positions.constEnd(), last)
+                 - positions.constBegin());
+    int i = int(std::upper_bound(values.constBegin() + lo,
+                                 values.constBegin() + hi, key)
+                - values.constBegin());
+    *before = i == lo;
+    return i > lo ? positions[i - 1] : -1;
+}
+
+}
+
+LookupCache::LookupCache()
+    : useClock(0)
+{
+}
+
+// Returns the offset of key in a one-row or one-column range, or -1.
+// An exact lookup finds the first equal entry.  A sorted one expects
+// ascending data and finds the last of the largest entries not greater
+// than key, as a binary search would.  Only entries of the key's type
+// are compared, and booleans always match exactly.
+int LookupCache::find(const CellStore &store, const CellRange &range,
+                      const Value &key, bool sorted) const
+{
+    if (!key.isNumber() && !key.isString() && !key.isBool())
+        return -1;
+    if (length(range) < MinIndexedCells)
+        return scan(store, range, key, sorted);
+
+    QVector<BlockPointer> found = blocks(store, range);
+    int first = isColumn(range) ? range.top : range.left;
+    int last = isColumn(range) ? range.bottom : range.right;
+    int position = -1;
+
+    if (key.isBool()) {
+        for (int i = 0; i < found.size() && position < 0; ++i)
+            position = firstPosition(found[i]->booleans[key.toBool()],
+                                     first, last);
+    } else if (key.isNumber()) {
+        double number = normalized(key.toNumber());
+        if (number != number)
+            return -1;
+        if (sorted) {
+            bool before = true;
+            for (int i = found.size() - 1; i >= 0 && before; --i)
+                position = floorPosition(found[i]->numberPositions,
+                                         found[i]->numberValues, number,
+                                         first, last, &before);
+        } else {
+            for (int i = 0; i < found.size() && position < 0; ++i)
+                position = firstPosition(found[i]->numbers, number,
+                                         first, last);
+        }
+    } else {
+        QString text = folded(store, key);
+        if (sorted) {
+            bool before = true;
+            for (int i = found.size() - 1; i >= 0 && before; --i)
+                position = floorPosition(found[i]->stringPositions,
+                                         found[i]->stringValues, text,
+                                         first, last, &before);
+        } else {
+            for (int i = 0; i < found.size() && position < 0; ++i)
+                position = firstPosition(found[i]->strings, text,
+                                         first, last);
+        }
+    }
+    return position < 0 ? -1 : position - first;
+}
+
+// Takes over the indexes of another cache, which must be looking at a
+// copy of the same store: their blocks are checked against its
+// versions.  The blocks are shared; the lines holding them are not.
+void LookupCache::share(const LookupCache &other)
+{
+    if (&other == this)
+        return;
+
+    QHash<quint64, QSharedPointer<Line> > copies;
+    quint64 theirClock;
+    {
+        QMutexLocker locker(&other.mutex);
+        QHash<quint64, QSharedPointer<Line> >::const_iterator i;
+        for (i = other.lines.constBegin(); i != other.lines.constEnd(); ++i) {
+            QSharedPointer<Line> copy(new Line);
+            QMutexLocker lineLocker(&i.value()->mutex);
+            copy->blocks = i.value()->blocks;
+            copy->lastUse = i.value()->lastUse;
+            copies.insert(i.key(), copy);
+        }
+        theirClock = other.useClock;
+    }
+
+    QMutexLocker locker(&mutex);
+    lines = copies;
+    useClock = qMax(useClock, theirClock);
+}
+
+int LookupCache::count() const
+{
+    QMutexLocker locker(&mutex);
+    return lines.size();
+}
+
+void LookupCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    lines.clear();
+}
+
+// Returns the blocks of a range's line that overlap it, in order,
+// checking and rebuilding them as needed.
+QVector<LookupCache::BlockPointer> LookupCache::blocks(
+        const CellStore &store, const CellRange &range) const
+{
+    bool column = isColumn(range);
+    quint64 lineKey = column ? quint64(range.left)
+                             : RowBit | quint64(range.top);
+
+    QSharedPointer<Line> line;
+    {
+        QMutexLocker locker(&mutex);
+        line = lines.value(lineKey);
+        if (!line) {
+            if (lines.size() >= MaxIndexes)
+                evictLeastRecent();
+            line = QSharedPointer<Line>(new Line);
+            lines.insert(lineKey, line);
+        }
+        line->lastUse = ++useClock;
+    }
+
+    // Rows have no version of their own; any write to the sheet sends
+    // their blocks back for a check.
+    quint64 current = column ? store.columnVersion(range.left)
+                             : store.version();
+    int first = (column ? range.top : range.left) / BlockSize;
+    int last = (column ? range.bottom : range.right) / BlockSize;
+    int end = column ? CellReference::MaxRows : CellReference::MaxColumns;
+
+    QVector<BlockPointer> result;
+    QMutexLocker locker(&line->mutex);
+    if (line->blocks.size() <= last)
+        line->blocks.resize(last + 1);
+    for (int n = first; n <= last; ++n) {
+        Slot &slot = line->blocks[n];
+        if (!slot.block || slot.checked != current) {
+            int start = n * BlockSize;
+            int stop = qMin(start + int(BlockSize), end) - 1;
+            CellRange cells = { range.top, start, range.top, stop };
+            if (column) {
+                CellRange columnCells = { start, range.left, stop,
+                                          range.left };
+                cells = columnCells;
+            }
+            int chunks;
+            quint64 version = store.rangeVersion(cells, &chunks);
+            if (!slot.block || slot.block->version != version
+                    || slot.block->chunks != chunks)
+                slot.block = build(store, cells, column, version, chunks);
+            slot.checked = current;
+        }
+        result.append(slot.block);
+    }
+    return result;
+}
+
+// Called with the mutex held.
+void LookupCache::evictLeastRecent() const
+{
+    QHash<quint64, QSharedPointer<Line> >::iterator oldest = lines.end();
+    for (QHash<quint64, QSharedPointer<Line> >::iterator i = lines.begin();
+         i != lines.end(); ++i) {
+        if (oldest == lines.end()
+                || i.value()->lastUse < oldest.value()->lastUse)
+            oldest = i;
+    }
+    if (oldest != lines.end())
+        lines.erase(oldest);
+}
+
+LookupCache::BlockPointer LookupCache::build(const CellStore &store,
+                                             const CellRange &cells,
+                                             bool column, quint64 version,
+                                             int chunks)
+{
+    QSharedPointer<Block> block(new Block);
+    block->version = version;
+    block->chunks = chunks;
+
+    QVector<quint64> keys;
+    store.usedCells(cells, &keys);
+    std::sort(keys.begin(), keys.end());
+
+    foreach (quint64 key, keys) {
+        int row = DependencyGraph::row(key);
+        int col = DependencyGraph::column(key);
+        int position = column ? row : col;
+        Value value = store.cell(row, col)->value();
+        if (value.isNumber()) {
+            double number = normalized(value.toNumber());
+            if (number != number)
+                continue;
+            block->numbers.append(qMakePair(number, position));
+            block->numberPositions.append(position);
+            block->numberValues.append(number);
+        } else if (value.isString()) {
+            QString text = folded(store, value);
+            block->strings.append(qMakePair(text, position));
+            block->stringPositions.append(position);
+            block->stringValues.append(text);
+        } else if (value.isBool()) {
+            block->booleans[value.toBool()].append(position);
+        }
+    }
+
+    std::sort(block->numbers.begin(), block->numbers.end());
+    std::sort(block->strings.begin(), block->strings.end());
+    return block;
+}
+
+// Small ranges are searched directly; building an index would cost
+// more than it saves.
+int LookupCache::scan(const CellStore &store, const CellRange &range,
+                      const Value &key, bool sorted)
+{
+    double number = key.isNumber() ? normalized(key.toNumber()) : 0.0;
+    QString text = key.isString() ? folded(store, key) : QString();
+
+    int best = -1;
+    double bestNumber = 0.0;
+    QString bestText;
+
+    int n = length(range);
+    for (int offset = 0; offset < n; ++offset) {
+        Value value = valueAt(store, range, offset);
+        if (value.type() != key.type())
+            continue;
+
+        if (key.isBool()) {
+            if (value.toBool() == key.toBool())
+                return offset;
+        } else if (key.isNumber()) {
+            double x = normalized(value.toNumber());
+            if (!sorted) {
+                if (x == number)
+                    return offset;
+            } else if (x <= number && (best < 0 || x >= bestNumber)) {
+                best = offset;
+                bestNumber = x;
+            }
+        } else {
+            QString str = folded(store, value);
+            if (!sorted) {
+                if (str == text)
+                    return offset;
+            } else if (str <= text && (best < 0 || str >= bestText)) {
+                best = offset;
+                bestText = str;
+            }
+        }
+    }
+    return best;
+}
@@ -0,0 +1,91 @@
+#ifndef LOOKUPCACHE_H
+#define LOOKUPCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "cellreference.h"
+#include "value.h"
+
+class CellStore;
+
+// The indexes behind VLOOKUP, MATCH and XLOOKUP.  Indexes cover whole
+// columns, or whole rows for horizontal lookups, in blocks of
+// BlockSize cells, so formulas filled down over shifting ranges of the
+// same column share them.  A block is built on the first lookup that
+// needs it and rebuilt only when a cell in it changes.  Built blocks
+// are never modified, so they can be read by several evaluation
+// threads and handed on to another sheet.
+class LookupCache
+{
+public:
+    enum { MinIndexedCells = 16, MaxIndexes = 256, BlockSize = 4096 };
+
+    LookupCache();
+
+    int find(const CellStore &store, const CellRange &range,
+             const Value &key, bool sorted) const;
+    void share(const LookupCache &other);
+    int count() const;
+    void clear();
+
+private:
+    struct Block
+    {
+        // CellStore::rangeVersion() of the cells it was built from.
+        quint64 version;
+        int chunks;
+        // Exact matches search (value, position) pairs in ascending
+        // order; sorted ones the entries of each type in position
+        // order.
+        QVector<QPair<double, int> > numbers;
+        QVector<QPair<QString, int> > strings;
+        QVector<int> booleans[2];
+        QVector<int> numberPositions;
+        QVector<double> numberValues;
+        QVector<int> stringPositions;
+        QVector<QString> stringValues;
+    };
+
+    typedef QSharedPointer<const Block> BlockPointer;
+
+    struct Slot
+    {
+        Slot() : checked(0) {}
+
+        BlockPointer block;
+        // The column or sheet version the block was last found valid
+        // at; until it moves on, the block is used without a check.
+        quint64 checked;
+    };
+
+    // The blocks of one column or row.  The first thread to need a
+    // stale block rebuilds it while the others needing the same line
+    // wait; lookups in other lines go on.
+    struct Line
+    {
+        Line() : lastUse(0) {}
+
+        QMutex mutex;
+        QVector<Slot> blocks;
+        quint64 lastUse;
+    };
+
+    QVector<BlockPointer> blocks(const CellStore &store,
+                                 const CellRange &range) const;
+    void evictLeastRecent() const;
+    static BlockPointer build(const CellStore &store, const CellRange &cells,
+                              bool column, quint64 version, int chunks);
+    static int scan(const CellStore &store, const CellRange &range,
+                    const Value &key, bool sorted);
+
+    mutable QMutex mutex;
+    mutable QHash<quint64, QSharedPointer<Line> > lines;
+    mutable quint64 useClock;
+};
+
+#endif // LOOKUPCACHE_H
@@ -1,6 +1,9 @@
+#include "cellreference.h"
 #include "mainwindow.h"
 #include "finddialog.h"
 #include "gotocelldialog.h"
+#include "profiler.h"
+#include "profilerpanel.h"
 #include "spreadsheet.h"
 #include "sortdialog.h"
 
@@ -15,17 +18,24 @@
 #include <QCloseEvent>
 #include <QStringList>
 #include <QFileInfo>
-#include <QTableWidgetSelectionRange>
+#include <QInputDialog>
+#include <QItemSelectionRange>
 #include <QSettings>
 #include <QMutableListIterator>
 #include <QDebug>
+#include <QApplication>
+#include <QDockWidget>
+#include <QProgressBar>
+#include <QToolButton>
 
 MainWindow::MainWindow()    // OK
 {
     spreadsheet = new Spreadsheet;
     setCentralWidget(spreadsheet);
+    importing = false;
 
     createActions();
+    createDockWindows();
     createMenus();
     createContextMenu();
     createToolBars();
@@ -77,6 +87,17 @@ void MainWindow::createActions()    // OK
     connect(saveAsAction, SIGNAL(triggered()),
             this, SLOT(saveAs()));
 
+    importAction = new QAction(tr("&Import..."), this);
+    importAction->setStatusTip(tr("Import a CSV or tab-separated file"));
+    connect(importAction, SIGNAL(triggered()),
+            this, SLOT(importFile()));
+
+    exportAction = new QAction(tr("&Export..."), this);
+    exportAction->setStatusTip(tr("Export the values as CSV or "
+                                  "tab-separated text"));
+    connect(exportAction, SIGNAL(triggered()),
+            this, SLOT(exportFile()));
+
     for (int i = 0; i < MaxRecentFiles; ++i) {
         recentFileActions[i] = new QAction(this);
         recentFileActions[i]->setVisible(false);
@@ -115,6 +136,18 @@ void MainWindow::createActions()    // OK
     connect(exitAction, SIGNAL(triggered()),
             qApp, SLOT(closeAllWindows()));
 
+    undoAction = new QAction(tr("&Undo"), this);
+    undoAction->setShortcut(QKeySequence::Undo);
+    undoAction->setStatusTip(tr("Undo the last edit"));
+    connect(undoAction, SIGNAL(triggered(bool)),
+            spreadsheet, SLOT(undo()));
+
+    redoAction = new QAction(tr("&Redo"), this);
+    redoAction->setShortcut(QKeySequence::Redo);
+    redoAction->setStatusTip(tr("Redo the last edit undone"));
+    connect(redoAction, SIGNAL(triggered(bool)),
+            spreadsheet, SLOT(redo()));
+
     cutAction = new QAction(tr("&Cut"), this);
     cutAction->setIcon(QIcon(":/pictures/logo/cut.png"));
     cutAction->setShortcut(tr("Ctrl+X"));
@@ -139,6 +172,21 @@ void MainWindow::createActions()    // OK
     connect(deleteAction, SIGNAL(triggered(bool)),
             spreadsheet, SLOT(del()));
 
+    fillDownAction = new QAction(tr("Fill &Down"), this);
+    fillDownAction->setShortcut(tr("Ctrl+D"));
+    fillDownAction->setStatusTip(tr("Copy the top row of the selection "
+                                    "into the rows below it"));
+    connect(fillDownAction, SIGNAL(triggered(bool)),
+            spreadsheet, SLOT(fillDown()));
+
+    fillRightAction = new QAction(tr("Fill &Right"), this);
+    fillRightAction->setShortcut(tr("Ctrl+R"));
+    fillRightAction->setStatusTip(tr("Copy the left column of the "
+                                     "selection into the columns to its "
+                                     "right"));
+    connect(fillRightAction, SIGNAL(triggered(bool)),
+            spreadsheet, SLOT(fillRight()));
+
     selectRowAction = new QAction(tr("&SelectRow"), this);
     connect(selectRowAction, SIGNAL(triggered(bool)),
             spreadsheet, SLOT(selectCurrentRow()));
@@ -173,6 +221,37 @@ void MainWindow::createActions()    // OK
     connect(autoRecalcAction, SIGNAL(triggered(bool)),
             spreadsheet, SLOT(setAutoRecalculate(bool)));
 
+    profileAction = new QAction(tr("&Profile Recalculation"), this);
+    profileAction->setCheckable(true);
+    profileAction->setStatusTip(tr("Record how long each cell takes to "
+                                   "evaluate"));
+    connect(profileAction, SIGNAL(toggled(bool)),
+            this, SLOT(setProfiling(bool)));
+
+    exportProfileAction = new QAction(tr("&Export Profile..."), this);
+    exportProfileAction->setStatusTip(tr("Save the recorded timings as "
+                                         "JSON or a Chrome trace"));
+    connect(exportProfileAction, SIGNAL(triggered(bool)),
+            this, SLOT(exportProfile()));
+
+    heatMapAction = new QAction(tr("Show &Heat Map"), this);
+    heatMapAction->setCheckable(true);
+    heatMapAction->setStatusTip(tr("Shade cells by their evaluation time"));
+    connect(heatMapAction, SIGNAL(toggled(bool)),
+            spreadsheet, SLOT(setHeatMap(bool)));
+
+    threadCountAction = new QAction(tr("Calculation &Threads..."), this);
+    threadCountAction->setStatusTip(tr("Set the number of threads used "
+                                       "for recalculation"));
+    connect(threadCountAction, SIGNAL(triggered(bool)),
+            this, SLOT(setThreadCount()));
+
+    undoMemoryAction = new QAction(tr("&Undo Memory..."), this);
+    undoMemoryAction->setStatusTip(tr("Set how much memory the undo "
+                                      "history may use"));
+    connect(undoMemoryAction, SIGNAL(triggered(bool)),
+            this, SLOT(setUndoMemoryLimit()));
+
     aboutAction = new QAction(tr("&About"), this);
     aboutAction->setStatusTip(tr("Brief information about program"));
     connect(aboutAction, SIGNAL(triggered(bool)),
@@ -186,6 +265,9 @@ void MainWindow::createMenus()  // OK
     fileMenu->addAction(openAction);
     fileMenu->addAction(saveAction);
     fileMenu->addAction(saveAsAction);
+    fileMenu->addSeparator();
+    fileMenu->addAction(importAction);
+    fileMenu->addAction(exportAction);
 
     separatorAction = fileMenu->addSeparator();
     for (int i = 0; i < MaxRecentFiles; ++i)
@@ -195,10 +277,15 @@ void MainWindow::createMenus()  // OK
     fileMenu->addAction(exitAction);
 
     editMenu = menuBar()->addMenu(tr("&Edit"));
+    editMenu->addAction(undoAction);
+    editMenu->addAction(redoAction);
+    editMenu->addSeparator();
     editMenu->addAction(cutAction);
     editMenu->addAction(copyAction);
     editMenu->addAction(pasteAction);
     editMenu->addAction(deleteAction);
+    editMenu->addAction(fillDownAction);
+    editMenu->addAction(fillRightAction);
 
     selectSubMenu = editMenu->addMenu(tr("&Select"));
     selectSubMenu->addAction(selectRowAction);
@@ -212,10 +299,17 @@ void MainWindow::createMenus()  // OK
     toolsMenu = menuBar()->addMenu(tr("&Tools"));
     toolsMenu->addAction(recalculateAction);
     toolsMenu->addAction(sortAction);
+    toolsMenu->addSeparator();
+    toolsMenu->addAction(profileAction);
+    toolsMenu->addAction(profilerDock->toggleViewAction());
+    toolsMenu->addAction(exportProfileAction);
 
     optionsMenu = menuBar()->addMenu(tr("&Options"));
     optionsMenu->addAction(showGridAction);
     optionsMenu->addAction(autoRecalcAction);
+    optionsMenu->addAction(heatMapAction);
+    optionsMenu->addAction(threadCountAction);
+    optionsMenu->addAction(undoMemoryAction);
 
     menuBar()->addSeparator();
 
@@ -252,24 +346,75 @@ void MainWindow::createToolBars()   //OK
     editToolBar->setMovable(false);
 }
 
+void MainWindow::createDockWindows()
+{
+    profilerPanel = new ProfilerPanel(spreadsheet->profiler());
+    profilerDock = new QDockWidget(tr("Slowest Cells"), this);
+    profilerDock->setObjectName("profilerDock");
+    profilerDock->setWidget(profilerPanel);
+    profilerDock->hide();
+    addDockWidget(Qt::RightDockWidgetArea, profilerDock);
+
+    connect(profilerDock, SIGNAL(visibilityChanged(bool)),
+            profilerPanel, SLOT(refresh()));
+    connect(spreadsheet, SIGNAL(recalculated()),
+            profilerPanel, SLOT(refresh()));
+    connect(profilerPanel, SIGNAL(cellActivated(int, int)),
+            this, SLOT(showCell(int, int)));
+}
+
 void MainWindow::createStatusBar()  // OK
 {
-    locationLabel = new QLabel(" W999 ");
+    locationLabel = new QLabel(" XFD1048576 ");
     locationLabel->setAlignment(Qt::AlignHCenter);
     locationLabel->setMinimumSize(locationLabel->sizeHint());
 
     formulaLabel = new QLabel;
     formulaLabel->setIndent(1);
 
+    statisticsLabel = new QLabel;
+    statisticsLabel->setIndent(1);
+
+    loadProgressBar = new QProgressBar;
+    loadProgressBar->setRange(0, 100);
+    loadProgressBar->setMaximumWidth(160);
+    loadProgressBar->hide();
+
+    cancelLoadButton = new QToolButton;
+    cancelLoadButton->setText(tr("Cancel"));
+    cancelLoadButton->setAutoRaise(true);
+    cancelLoadButton->hide();
+
     statusBar()->addWidget(locationLabel);
     statusBar()->addWidget(formulaLabel, 1);
+    statusBar()->addPermanentWidget(statisticsLabel);
+    statusBar()->addPermanentWidget(loadProgressBar);
+    statusBar()->addPermanentWidget(cancelLoadButton);
 
     connect(spreadsheet, SIGNAL(currentCellChanged(int, int, int, int)),
             this, SLOT(updateStatusBar()));
     connect(spreadsheet, SIGNAL(modified()),
             this, SLOT(spreadsheetModified()));
+    connect(spreadsheet, SIGNAL(modified()),
+            this, SLOT(updateUndoActions()));
+    connect(spreadsheet->selectionModel(),
+            SIGNAL(selectionChanged(const QItemSelection &,
+                                    const QItemSelection &)),
+            this, SLOT(updateStatistics()));
+    connect(spreadsheet, SIGNAL(modified()),
+            this, SLOT(updateStatistics()));
+    connect(spreadsheet, SIGNAL(recalculated()),
+            this, SLOT(updateStatistics()));
+    connect(spreadsheet, SIGNAL(readProgress(int)),
+            loadProgressBar, SLOT(setValue(int)));
+    connect(spreadsheet, SIGNAL(fileRead(bool)),
+            this, SLOT(fileRead(bool)));
+    connect(cancelLoadButton, SIGNAL(clicked()),
+            spreadsheet, SLOT(cancelReading()));
 
     updateStatusBar();
+    updateUndoActions();
+    updateStatistics();
 }
 
 void MainWindow::updateStatusBar()  // OK
@@ -278,6 +423,37 @@ void MainWindow::updateStatusBar()  // OK
     formulaLabel->setText(spreadsheet->currentFormula());
 }
 
+// Shown once the selection holds more than one number, as a quick
+// check of a column or block without entering a formula.
+void MainWindow::updateStatistics()
+{
+    RangeSummary summary = spreadsheet->selectionSummary();
+    if (summary.count < 2) {
+        statisticsLabel->clear();
+        return;
+    }
+
+    statisticsLabel->setText(
+            tr("Sum: %1  Average: %2  Count: %3  Min: %4  Max: %5")
+            .arg(QString::number(summary.sum, 'g', 15))
+            .arg(QString::number(summary.sum / summary.count, 'g', 15))
+            .arg(summary.count)
+            .arg(QString::number(summary.min, 'g', 15))
+            .arg(QString::number(summary.max, 'g', 15)));
+}
+
+void MainWindow::updateUndoActions()
+{
+    undoAction->setEnabled(spreadsheet->canUndo());
+    undoAction->setText(spreadsheet->canUndo()
+                        ? tr("&Undo %1").arg(spreadsheet->undoText())
+                        : tr("&Undo"));
+    redoAction->setEnabled(spreadsheet->canRedo());
+    redoAction->setText(spreadsheet->canRedo()
+                        ? tr("&Redo %1").arg(spreadsheet->redoText())
+                        : tr("&Redo"));
+}
+
 void MainWindow::spreadsheetModified()  // OK
 {
     setWindowModified(true);
@@ -320,7 +496,7 @@ bool MainWindow::okToContinue() // OK
 void MainWindow::open() // OK
 {
     if(okToContinue()) {
-        QString filter = tr("Spreadsheet files (*.sp)");
+        QString filter = tr("Spreadsheet files (*.sps *.sp)");
         QString fileName = QFileDialog::getOpenFileName(this,
                                    tr("Open Spreadsheet"), ".",
                                    filter);
@@ -329,16 +505,40 @@ void MainWindow::open() // OK
     }
 }
 
-bool MainWindow::loadFile(const QString &fileName)  // OK
+void MainWindow::loadFile(const QString &fileName)  // OK
 {
-    if (!spreadsheet->readFile(fileName)) {
-        statusBar()->showMessage(tr("Loading cancelled"), 2000);
-        return false;
-    }
+    readFile(fileName, false);
+}
 
-    setCurrentFile(fileName);
-    statusBar()->showMessage(tr("File loaded"), 2000);
-    return true;
+// Files are read in the background; the status bar shows the progress
+// and a button to cancel until fileRead() is called.
+void MainWindow::readFile(const QString &fileName, bool import)
+{
+    readingFile = fileName;
+    importing = import;
+    loadProgressBar->setValue(0);
+    loadProgressBar->show();
+    cancelLoadButton->show();
+    spreadsheet->readFile(fileName);
+}
+
+void MainWindow::fileRead(bool ok)
+{
+    loadProgressBar->hide();
+    cancelLoadButton->hide();
+
+    // The sheet was emptied when the read started, so it no longer
+    // holds the file that was open before; saving it there would
+    // overwrite that file with nothing.
+    if (!ok) {
+        setCurrentFile("");
+        statusBar()->showMessage(importing ? tr("Import cancelled")
+                                           : tr("Loading cancelled"), 2000);
+        return;
+    }
+    setCurrentFile(importing ? QString() : readingFile);
+    statusBar()->showMessage(importing ? tr("File imported")
+                                       : tr("File loaded"), 2000);
 }
 
 bool MainWindow::save() // OK
@@ -366,13 +566,45 @@ bool MainWindow::saveAs()   // OK
 {
     QString fileName = QFileDialog::getSaveFileName(this,
                                 tr("Save Spreadsheet"), ".",
-                                tr("Spreadsheet files (*.sp)"));
+                                tr("Spreadsheet files (*.sps)"));
     if (fileName.isEmpty())
         return false;
 
     return saveFile(fileName);
 }
 
+// An imported file becomes an untitled sheet, so that saving it never
+// overwrites the text file with the binary format.
+void MainWindow::importFile()
+{
+    if (okToContinue()) {
+        QString fileName = QFileDialog::getOpenFileName(this,
+                                   tr("Import"), ".",
+                                   tr("Delimited text (*.csv *.tsv *.tab "
+                                      "*.txt)"));
+        if (fileName.isEmpty())
+            return;
+
+        readFile(fileName, true);
+    }
+}
+
+void MainWindow::exportFile()
+{
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                tr("Export"), ".",
+                                tr("Comma-separated values (*.csv);;"
+                                   "Tab-separated values (*.tsv)"));
+    if (fileName.isEmpty())
+        return;
+
+    if (spreadsheet->exportFile(fileName)) {
+        statusBar()->showMessage(tr("File exported"), 2000);
+    } else {
+        statusBar()->showMessage(tr("Export canceled"), 2000);
+    }
+}
+
 void MainWindow::setCurrentFile(const QString &fileName)    // OK
 {
     curFile = fileName;
@@ -387,6 +619,7 @@ void MainWindow::setCurrentFile(const QString &fileName)    // OK
     }
     setWindowTitle(tr("%1[*] - %2").arg(shownName)
                                    .arg(tr("Spreadsheet")));
+    updateUndoActions();
 }
 
 QString MainWindow::strippedName(const QString &fullFileName)   // OK
@@ -429,28 +662,48 @@ void MainWindow::find()     //OK
                                             Qt::CaseSensitivity)),
                 spreadsheet, SLOT(findPrevious(const QString&,
                                            Qt::CaseSensitivity)));
+        connect(findDialog, SIGNAL(findAll(const QString&,
+                                           Qt::CaseSensitivity)),
+                this, SLOT(findAll(const QString&, Qt::CaseSensitivity)));
+        connect(findDialog, SIGNAL(cellActivated(int, int)),
+                this, SLOT(showCell(int, int)));
     }
 
     findDialog->show();
     findDialog->activateWindow();
 }
 
+void MainWindow::findAll(const QString &str, Qt::CaseSensitivity cs)
+{
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QStringList texts;
+    QVector<CellReference> cells = spreadsheet->findAll(str, cs, &texts);
+    findDialog->showResults(cells, texts);
+    QApplication::restoreOverrideCursor();
+}
+
+void MainWindow::showCell(int row, int column)
+{
+    spreadsheet->clearSelection();
+    spreadsheet->setCurrentCell(row, column);
+    activateWindow();
+}
+
 void MainWindow::goToCell() // OK
 {
     GoToCellDialog dialog(this);
     if (dialog.exec()) {
-        QString str = dialog.lineEdit->text().toUpper();
-        spreadsheet->setCurrentCell(str.mid(1).toInt() - 1,
-                                    str[0].unicode() - 'A');
+        CellReference ref;
+        if (CellReference::parse(dialog.lineEdit->text(), &ref))
+            spreadsheet->setCurrentCell(ref.row, ref.column);
     }
 }
 
 void MainWindow::sort()     // OK
 {
     SortDialog dialog(this);
-    QTableWidgetSelectionRange range = spreadsheet->selectedRange();
-    dialog.setColumnRange('A' + range.leftColumn(),
-                          'A' + range.rightColumn());
+    QItemSelectionRange range = spreadsheet->selectedRange();
+    dialog.setColumnRange(range.left(), range.right());
     if (dialog.exec()) {
         SpreadsheetCompare compare;
         compare.keys[0] =
@@ -469,6 +722,63 @@ void MainWindow::sort()     // OK
     }
 }
 
+void MainWindow::setProfiling(bool on)
+{
+    spreadsheet->setProfiling(on);
+    if (on)
+        profilerDock->show();
+}
+
+void MainWindow::exportProfile()
+{
+    QString jsonFilter = tr("Profile (*.json)");
+    QString traceFilter = tr("Chrome trace (*.json)");
+    QString selectedFilter;
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                tr("Export Profile"), ".",
+                                jsonFilter + ";;" + traceFilter,
+                                &selectedFilter);
+    if (fileName.isEmpty())
+        return;
+
+    QString errorString;
+    Profiler *profiler = spreadsheet->profiler();
+    bool ok = (selectedFilter == traceFilter)
+            ? profiler->writeTrace(fileName, &errorString)
+            : profiler->writeJson(fileName, &errorString);
+    if (!ok) {
+        QMessageBox::warning(this, tr("Spreadsheet"),
+                             tr("Cannot write file %1:\n%2")
+                             .arg(fileName).arg(errorString));
+        return;
+    }
+    statusBar()->showMessage(tr("Profile exported"), 2000);
+}
+
+void MainWindow::setThreadCount()
+{
+    bool ok;
+    int count = QInputDialog::getInt(this, tr("Calculation Threads"),
+                                     tr("Threads used for recalculation:"),
+                                     spreadsheet->threadCount(), 1, 256, 1,
+                                     &ok);
+    if (ok)
+        spreadsheet->setThreadCount(count);
+}
+
+void MainWindow::setUndoMemoryLimit()
+{
+    bool ok;
+    int megabytes = QInputDialog::getInt(this, tr("Undo Memory"),
+            tr("Memory kept for undo (MB):"),
+            int(spreadsheet->undoMemoryLimit() / (1024 * 1024)), 0, 65536,
+            64, &ok);
+    if (ok) {
+        spreadsheet->setUndoMemoryLimit(megabytes * Q_INT64_C(1048576));
+        updateUndoActions();
+    }
+}
+
 void MainWindow::about()    // OK
 {
     QMessageBox::about(this, tr("About Spreadsheet"),
@@ -476,7 +786,7 @@ void MainWindow::about()    // OK
             "<p>Copyright &copy; 2017 Software Inc."
             "<p>Spreadsheet is a small application that "
             "demonstrates QAction, QMainWindow, QMenuBar, "
-            "QStatusBar, QTableWidget, QToolBar, and many other "
+            "QStatusBar, QTableView, QToolBar, and many other "
             "Qt classes."));
 }
 
@@ -497,6 +807,8 @@ void MainWindow::writeSettings()    // OK
     settings.setValue("recentFiles", recentFiles);
     settings.setValue("showGrid", showGridAction->isChecked());
     settings.setValue("autoRecalc", autoRecalcAction->isChecked());
+    settings.setValue("threadCount", spreadsheet->threadCount());
+    settings.setValue("undoMemoryLimit", spreadsheet->undoMemoryLimit());
 }
 
 void MainWindow::readSettings()     //OK
@@ -516,4 +828,12 @@ void MainWindow::readSettings()     //OK
 
     bool autoRecalc = settings.value("autoRecalc", true).toBool();
     autoRecalcAction->setChecked(autoRecalc);
+
+    int threadCount = settings.value("threadCount",
+                                     spreadsheet->threadCount()).toInt();
+    spreadsheet->setThreadCount(threadCount);
+
+    qint64 undoMemoryLimit = settings.value("undoMemoryLimit",
+            spreadsheet->undoMemoryLimit()).toLongLong();
+    spreadsheet->setUndoMemoryLimit(undoMemoryLimit);
 }
@@ -4,8 +4,12 @@
 #include <QMainWindow>
 
 class QAction;
+class QDockWidget;
 class QLabel;
+class QProgressBar;
+class QToolButton;
 class FindDialog;
+class ProfilerPanel;
 class Spreadsheet;
 
 class MainWindow : public QMainWindow
@@ -23,24 +27,37 @@ private slots:
     void open();
     bool save();
     bool saveAs();
+    void importFile();
+    void exportFile();
     void find();
+    void findAll(const QString &str, Qt::CaseSensitivity cs);
+    void showCell(int row, int column);
     void goToCell();
     void sort();
+    void setThreadCount();
+    void setUndoMemoryLimit();
+    void setProfiling(bool on);
+    void exportProfile();
     void about();
     void openRecentFile();
     void updateStatusBar();
+    void updateUndoActions();
+    void updateStatistics();
     void spreadsheetModified();
+    void fileRead(bool ok);
 
 private:
     void createActions();
     void createMenus();
     void createContextMenu();
+    void createDockWindows();
     void createToolBars();
     void createStatusBar();
     void readSettings();
     void writeSettings();
     bool okToContinue();
-    bool loadFile(const QString &fileName);
+    void loadFile(const QString &fileName);
+    void readFile(const QString &fileName, bool import);
     bool saveFile(const QString &fileName);
     void setCurrentFile(const QString &fileName);
     void updateRecentFileActions();
@@ -49,10 +66,17 @@ private:
 private:
     Spreadsheet *spreadsheet;
     FindDialog  *findDialog;
+    ProfilerPanel *profilerPanel;
+    QDockWidget *profilerDock;
     QLabel      *locationLabel;
     QLabel      *formulaLabel;
+    QLabel      *statisticsLabel;
+    QProgressBar *loadProgressBar;
+    QToolButton *cancelLoadButton;
     QStringList recentFiles;
     QString     curFile;
+    QString     readingFile;
+    bool        importing;
 
     enum { MaxRecentFiles = 5 };
 
@@ -73,13 +97,19 @@ private:
     QAction     *openAction;
     QAction     *saveAction;
     QAction     *saveAsAction;
+    QAction     *importAction;
+    QAction     *exportAction;
     QAction     *closeAction;
     QAction     *exitAction;
 
+    QAction     *undoAction;
+    QAction     *redoAction;
     QAction     *cutAction;
     QAction     *copyAction;
     QAction     *pasteAction;
     QAction     *deleteAction;
+    QAction     *fillDownAction;
+    QAction     *fillRightAction;
     QAction     *selectRowAction;
     QAction     *selectColumnAction;
     QAction     *selectAllAction;
@@ -90,6 +120,11 @@ private:
     QAction     *sortAction;
     QAction     *showGridAction;
     QAction     *autoRecalcAction;
+    QAction     *threadCountAction;
+    QAction     *undoMemoryAction;
+    QAction     *profileAction;
+    QAction     *exportProfileAction;
+    QAction     *heatMapAction;
 
     QAction     *aboutAction;
     QAction     *aboutQtAction;
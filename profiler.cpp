@@ -0,0 +1,188 @@
+#include "profiler.h"
+#include "cellreference.h"
+#include "dependencygraph.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QPair>
+#include <QTextStream>
+
+#include <algorithm>
+#include <functional>
+
+Profiler::Profiler()
+    : origin(0), slowest(0)
+{
+    timer.start();
+}
+
+// Called once per evaluated level with the events of all its cells;
+// the threads of the level each filled in their own entries.
+void Profiler::recordLevel(const QVector<Event> &levelEvents)
+{
+    QMutexLocker locker(&mutex);
+    foreach (const Event &event, levelEvents) {
+        CellStats &cell = stats[event.key];
+        ++cell.evaluations;
+        cell.nanoseconds += event.duration;
+        cell.depth = event.depth;
+        slowest = qMax(slowest, cell.nanoseconds);
+    }
+
+    int room = MaxEvents - events.size();
+    if (room > 0)
+        events += levelEvents.mid(0, room);
+}
+
+void Profiler::recordRecalculation(qint64 start, int cells, int levels)
+{
+    Recalculation recalc = { start, now() - start, cells, levels };
+    QMutexLocker locker(&mutex);
+    recalcs.append(recalc);
+}
+
+void Profiler::clear()
+{
+    QMutexLocker locker(&mutex);
+    stats.clear();
+    events.clear();
+    recalcs.clear();
+    slowest = 0;
+    origin.storeRelease(timer.nsecsElapsed());
+}
+
+Profiler::CellStats Profiler::cellStats(quint64 key) const
+{
+    QMutexLocker locker(&mutex);
+    return stats.value(key);
+}
+
+// The largest total time spent in one cell, which the heat map uses as
+// its full scale.
+qint64 Profiler::slowestCell() const
+{
+    QMutexLocker locker(&mutex);
+    return slowest;
+}
+
+QVector<quint64> Profiler::slowestCells(int count) const
+{
+    QMutexLocker locker(&mutex);
+    QVector<QPair<qint64, quint64> > cells;
+    cells.reserve(stats.size());
+    QHash<quint64, CellStats>::const_iterator i = stats.constBegin();
+    for (; i != stats.constEnd(); ++i)
+        cells.append(qMakePair(i.value().nanoseconds, i.key()));
+
+    count = qMin(count, cells.size());
+    std::partial_sort(cells.begin(), cells.begin() + count, cells.end(),
+                      std::greater<QPair<qint64, quint64> >());
+
+    QVector<quint64> keys;
+    for (int i = 0; i < count; ++i)
+        keys.append(cells[i].second);
+    return keys;
+}
+
+QVector<Profiler::Recalculation> Profiler::recalculations() const
+{
+    QMutexLocker locker(&mutex);
+    return recalcs;
+}
+
+static QString cellName(quint64 key)
+{
+    CellReference ref = { DependencyGraph::row(key),
+                          DependencyGraph::column(key) };
+    return ref.toString();
+}
+
+bool Profiler::writeJson(const QString &fileName, QString *errorString) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+
+    out << "{\n  \"recalculations\": [";
+    for (int i = 0; i < recalcs.size(); ++i) {
+        const Recalculation &recalc = recalcs[i];
+        out << (i ? ",\n    " : "\n    ")
+            << "{\"start\": " << recalc.start
+            << ", \"nanoseconds\": " << recalc.duration
+            << ", \"cells\": " << recalc.cells
+            << ", \"levels\": " << recalc.levels << '}';
+    }
+
+    out << "\n  ],\n  \"cells\": [";
+    bool first = true;
+    QHash<quint64, CellStats>::const_iterator i = stats.constBegin();
+    for (; i != stats.constEnd(); ++i) {
+        out << (first ? "\n    " : ",\n    ");
+        first = false;
+        out << "{\"cell\": \"" << cellName(i.key())
+            << "\", \"evaluations\": " << i.value().evaluations
+            << ", \"nanoseconds\": " << i.value().nanoseconds
+            << ", \"depth\": " << i.value().depth << '}';
+    }
+    out << "\n  ]\n}\n";
+
+    out.flush();
+    if (out.status() != QTextStream::Ok) {
+        *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+// Writes the Trace Event Format read by chrome://tracing and Perfetto:
+// recalculations on thread 0, cell evaluations on the thread that ran
+// them, shifted by one.
+bool Profiler::writeTrace(const QString &fileName, QString *errorString) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(3);
+
+    out << "{\"traceEvents\": [";
+    bool first = true;
+    foreach (const Recalculation &recalc, recalcs) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\": \"Recalculation\", \"cat\": \"recalc\", "
+               "\"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": "
+            << recalc.start / 1000.0 << ", \"dur\": "
+            << recalc.duration / 1000.0 << ", \"args\": {\"cells\": "
+            << recalc.cells << ", \"levels\": " << recalc.levels << "}}";
+    }
+    foreach (const Event &event, events) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\": \"" << cellName(event.key)
+            << "\", \"cat\": \"cell\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << event.thread + 1 << ", \"ts\": " << event.start / 1000.0
+            << ", \"dur\": " << event.duration / 1000.0
+            << ", \"args\": {\"depth\": " << event.depth << "}}";
+    }
+    out << "\n]}\n";
+
+    out.flush();
+    if (out.status() != QTextStream::Ok) {
+        *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
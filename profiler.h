@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+// Collects timings of the evaluation path while it is attached to a
+// sheet.  The sheet only checks whether it has a profiler, so a sheet
+// without one pays a single branch per evaluated cell.
+class Profiler
+{
+public:
+    enum { MaxEvents = 1000000 };
+
+    struct CellStats
+    {
+        CellStats() : evaluations(0), nanoseconds(0), depth(0) {}
+
+        int evaluations;
+        qint64 nanoseconds;
+        int depth;
+    };
+
+    // One evaluation of one cell; times are relative to the profiler's
+    // creation or last clear().
+    struct Event
+    {
+        quint64 key;
+        qint64 start;
+        qint64 duration;
+        int thread;
+        int depth;
+    };
+
+    struct Recalculation
+    {
+        qint64 start;
+        qint64 duration;
+        int cells;
+        int levels;
+    };
+
+    Profiler();
+
+    qint64 now() const { return timer.nsecsElapsed() - origin.loadAcquire(); }
+    void recordLevel(const QVector<Event> &events);
+    void recordRecalculation(qint64 start, int cells, int levels);
+    void clear();
+
+    CellStats cellStats(quint64 key) const;
+    qint64 slowestCell() const;
+    QVector<quint64> slowestCells(int count) const;
+    QVector<Recalculation> recalculations() const;
+
+    bool writeJson(const QString &fileName, QString *errorString) const;
+    bool writeTrace(const QString &fileName, QString *errorString) const;
+
+private:
+    mutable QMutex mutex;
+    // Evaluation threads read the timer without the lock, so clear()
+    // moves the origin instead of restarting it.
+    QElapsedTimer timer;
+    QAtomicInteger<qint64> origin;
+    QHash<quint64, CellStats> stats;
+    QVector<Event> events;
+    QVector<Recalculation> recalcs;
+    qint64 slowest;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,97 @@
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QVBoxLayout>
+
+#include "dependencygraph.h"
+#include "profiler.h"
+#include "profilerpanel.h"
+
+ProfilerPanel::ProfilerPanel(Profiler *profiler, QWidget *parent)
+    : QWidget(parent), profiler(profiler)
+{
+    summaryLabel = new QLabel;
+
+    table = new QTableWidget(0, 4);
+    table->setHorizontalHeaderLabels(QStringList() << tr("Cell")
+                                     << tr("Time (ms)")
+                                     << tr("Evaluations")
+                                     << tr("Depth"));
+    table->verticalHeader()->hide();
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionBehavior(QAbstractItemView::SelectRows);
+
+    refreshButton = new QPushButton(tr("&Refresh"));
+    clearButton = new QPushButton(tr("C&lear"));
+
+    connect(refreshButton, SIGNAL(clicked()),
+            this, SLOT(refresh()));
+    connect(clearButton, SIGNAL(clicked()),
+            this, SLOT(clearProfile()));
+    connect(table, SIGNAL(cellActivated(int, int)),
+            this, SLOT(rowActivated(int)));
+
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
+    buttonLayout->addWidget(refreshButton);
+    buttonLayout->addWidget(clearButton);
+    buttonLayout->addStretch();
+
+    QVBoxLayout *mainLayout = new QVBoxLayout;
+    mainLayout->addWidget(summaryLabel);
+    mainLayout->addWidget(table);
+    mainLayout->addLayout(buttonLayout);
+    setLayout(mainLayout);
+
+    refresh();
+}
+
+void ProfilerPanel::refresh()
+{
+    if (!isVisible())
+        return;
+
+    QVector<Profiler::Recalculation> recalcs = profiler->recalculations();
+    if (recalcs.isEmpty()) {
+        summaryLabel->setText(tr("No recalculation profiled"));
+    } else {
+        const Profiler::Recalculation &last = recalcs.last();
+        summaryLabel->setText(tr("Last recalculation: %1 ms, %2 cells "
+                                 "in %3 levels")
+                              .arg(last.duration / 1e6, 0, 'f', 2)
+                              .arg(last.cells).arg(last.levels));
+    }
+
+    QVector<quint64> cells = profiler->slowestCells(TopCount);
+    table->setRowCount(cells.size());
+    for (int i = 0; i < cells.size(); ++i) {
+        CellReference ref = { DependencyGraph::row(cells[i]),
+                              DependencyGraph::column(cells[i]) };
+        Profiler::CellStats stats = profiler->cellStats(cells[i]);
+
+        QTableWidgetItem *cell = new QTableWidgetItem(ref.toString());
+        cell->setData(Qt::UserRole, ref.row);
+        cell->setData(Qt::UserRole + 1, ref.column);
+        table->setItem(i, 0, cell);
+        table->setItem(i, 1, new QTableWidgetItem(
+                QString::number(stats.nanoseconds / 1e6, 'f', 3)));
+        table->setItem(i, 2, new QTableWidgetItem(
+                QString::number(stats.evaluations)));
+        table->setItem(i, 3, new QTableWidgetItem(
+                QString::number(stats.depth)));
+    }
+}
+
+void ProfilerPanel::clearProfile()
+{
+    profiler->clear();
+    refresh();
+}
+
+void ProfilerPanel::rowActivated(int row)
+{
+    QTableWidgetItem *cell = table->item(row, 0);
+    emit cellActivated(cell->data(Qt::UserRole).toInt(),
+                       cell->data(Qt::UserRole + 1).toInt());
+}
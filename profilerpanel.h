@@ -0,0 +1,40 @@
+#ifndef PROFILERPANEL_H
+#define PROFILERPANEL_H
+
+#include <QWidget>
+
+class QLabel;
+class QPushButton;
+class QTableWidget;
+class Profiler;
+
+// Lists the cells that took the longest to evaluate since profiling
+// was turned on, with the wall time of the last recalculation.
+class ProfilerPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    enum { TopCount = 50 };
+
+    ProfilerPanel(Profiler *profiler, QWidget *parent = 0);
+
+public slots:
+    void refresh();
+
+signals:
+    void cellActivated(int row, int column);
+
+private slots:
+    void clearProfile();
+    void rowActivated(int row);
+
+private:
+    Profiler    *profiler;
+    QLabel      *summaryLabel;
+    QTableWidget *table;
+    QPushButton *refreshButton;
+    QPushButton *clearButton;
+};
+
+#endif // PROFILERPANEL_H
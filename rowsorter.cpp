@@ -0,0 +1,203 @@
+#include "rowsorter.h"
+#include "sheet.h"
+
+#include <QCollator>
+#include <QHash>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Numbers sort before strings, then booleans and errors; blanks come
+// last whichever the direction.
+enum Rank { NumberRank, StringRank, BooleanRank, ErrorRank, BlankRank };
+
+struct KeyColumn
+{
+    QVector<quint8> ranks;
+    QVector<double> numbers;
+    bool ascending;
+};
+
+class RowLess
+{
+public:
+    explicit RowLess(const QVector<KeyColumn> &keys) : keys(keys) {}
+
+    bool operator()(int a, int b) const
+    {
+        for (int i = 0; i < keys.size(); ++i) {
+            const KeyColumn &key = keys[i];
+            int rankA = key.ranks[a];
+            int rankB = key.ranks[b];
+            if (rankA != rankB) {
+                if (rankA == BlankRank || rankB == BlankRank)
+                    return rankB == BlankRank;
+                return key.ascending ? rankA < rankB : rankA > rankB;
+            }
+
+            double x = key.numbers[a];
+            double y = key.numbers[b];
+            if (x != y)
+                return key.ascending ? x < y : x > y;
+        }
+        return false;
+    }
+
+private:
+    const QVector<KeyColumn> &keys;
+};
+
+struct Run
+{
+    int *begin;
+    int *middle;
+    int *end;
+};
+
+struct SortRun
+{
+    typedef void result_type;
+
+    explicit SortRun(const RowLess &less) : less(less) {}
+    void operator()(Run &run) const
+        { std::stable_sort(run.begin, run.end, less); }
+
+    RowLess less;
+};
+
+struct MergeRuns
+{
+    typedef void result_type;
+
+    explicit MergeRuns(const RowLess &less) : less(less) {}
+    void operator()(Run &run) const
+        { std::inplace_merge(run.begin, run.middle, run.end, less); }
+
+    RowLess less;
+};
+
+KeyColumn readKey(Sheet *sheet, const CellRange &range,
+                  const RowSorter::Key &spec)
+{
+    int height = range.bottom - range.top + 1;
+
+    KeyColumn key;
+    key.ascending = spec.ascending;
+    key.ranks.resize(height);
+    key.numbers.resize(height);
+
+    // String cells first get their string id as their number.
+    QVector<int> stringRows;
+    for (int i = 0; i < height; ++i) {
+        Value value = sheet->value(range.top + i, spec.column);
+        switch (value.type()) {
+        case Value::Number:
+            key.ranks[i] = NumberRank;
+            key.numbers[i] = value.toNumber();
+            break;
+        case Value::String:
+            key.ranks[i] = StringRank;
+            key.numbers[i] = value.stringId();
+            stringRows.append(i);
+            break;
+        case Value::Boolean:
+            key.ranks[i] = BooleanRank;
+            key.numbers[i] = value.toBool() ? 1.0 : 0.0;
+            break;
+        case Value::Error:
+            key.ranks[i] = ErrorRank;
+            key.numbers[i] = value.errorCode();
+            break;
+        default:
+            key.ranks[i] = BlankRank;
+            key.numbers[i] = 0.0;
+        }
+    }
+    if (stringRows.isEmpty())
+        return key;
+
+    // Each distinct string is collated once, through its sort key, and
+    // then stands for its rank among the strings of the column.
+    QVector<int> ids;
+    ids.reserve(stringRows.size());
+    foreach (int row, stringRows)
+        ids.append(int(key.numbers[row]));
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+
+    std::vector<std::pair<QCollatorSortKey, int> > sortKeys;
+    sortKeys.reserve(ids.size());
+    foreach (int id, ids)
+        sortKeys.push_back(std::make_pair(
+                collator.sortKey(sheet->cells().strings().string(id)), id));
+    std::sort(sortKeys.begin(), sortKeys.end());
+
+    QHash<int, int> ranks;
+    ranks.reserve(ids.size());
+    int rank = 0;
+    for (size_t i = 0; i < sortKeys.size(); ++i) {
+        if (i > 0 && sortKeys[i - 1].first.compare(sortKeys[i].first) != 0)
+            ++rank;
+        ranks.insert(sortKeys[i].second, rank);
+    }
+
+    foreach (int row, stringRows)
+        key.numbers[row] = ranks.value(int(key.numbers[row]));
+    return key;
+}
+
+}
+
+// Returns the new order of the rows: entry i is the offset within the
+// range of the row that moves to offset i.  Equal rows keep their
+// order.  Large ranges are sorted as one run per thread, after which
+// neighbouring runs are merged pairwise, also in parallel.
+QVector<int> RowSorter::sort(Sheet *sheet, const CellRange &range,
+                             const QVector<Key> &keys)
+{
+    QVector<KeyColumn> columns;
+    foreach (const Key &key, keys)
+        columns.append(readKey(sheet, range, key));
+
+    int height = range.bottom - range.top + 1;
+    QVector<int> order(height);
+    for (int i = 0; i < height; ++i)
+        order[i] = i;
+
+    RowLess less(columns);
+    int threads = sheet->threadCount();
+    if (height < ParallelThreshold || threads < 2) {
+        std::stable_sort(order.begin(), order.end(), less);
+        return order;
+    }
+
+    int *data = order.data();
+    QVector<Run> runs;
+    for (int i = 0; i < threads; ++i) {
+        Run run = { data + qint64(height) * i / threads, 0,
+                    data + qint64(height) * (i + 1) / threads };
+        runs.append(run);
+    }
+    QtConcurrent::blockingMap(runs, SortRun(less));
+
+    while (runs.size() > 1) {
+        QVector<Run> merged;
+        for (int i = 0; i + 1 < runs.size(); i += 2) {
+            Run run = { runs[i].begin, runs[i].end, runs[i + 1].end };
+            merged.append(run);
+        }
+        QtConcurrent::blockingMap(merged, MergeRuns(less));
+        if (runs.size() % 2)
+            merged.append(runs.last());
+        runs = merged;
+    }
+    return order;
+}
@@ -0,0 +1,29 @@
+#ifndef ROWSORTER_H
+#define ROWSORTER_H
+
+#include <QVector>
+
+#include "cellreference.h"
+
+class Sheet;
+
+// Orders the rows of a range by the values of some of its columns.
+// Each key column is read once into contiguous arrays of type ranks
+// and numbers, strings being replaced by their collation rank, so the
+// sort itself only compares plain numbers.
+class RowSorter
+{
+public:
+    enum { ParallelThreshold = 65536 };
+
+    struct Key
+    {
+        int column;
+        bool ascending;
+    };
+
+    static QVector<int> sort(Sheet *sheet, const CellRange &range,
+                             const QVector<Key> &keys);
+};
+
+#endif // ROWSORTER_H
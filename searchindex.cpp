@@ -0,0 +1,168 @@
+#include "searchindex.h"
+#include "sheet.h"
+
+#include <algorithm>
+
+SearchIndex::SearchIndex()
+    : built(false), postingCount(0), liveCount(0)
+{
+}
+
+void SearchIndex::clear()
+{
+    built = false;
+    texts.clear();
+    postings.clear();
+    postingCount = 0;
+    liveCount = 0;
+}
+
+// Returns the keys of the matching cells in row-major order.  Cells
+// still waiting for a background recalculation are left out.
+QVector<quint64> SearchIndex::find(Sheet *sheet, const QString &str,
+                                   Qt::CaseSensitivity cs)
+{
+    refresh(sheet);
+
+    QVector<quint64> matches;
+    if (str.isEmpty())
+        return matches;
+
+    QVector<quint64> grams = trigrams(str);
+    if (grams.isEmpty()) {
+        QHash<quint64, QString>::const_iterator i = texts.constBegin();
+        for (; i != texts.constEnd(); ++i) {
+            if (i.value().contains(str, cs))
+                matches.append(i.key());
+        }
+    } else {
+        const QVector<quint64> *rarest = 0;
+        foreach (quint64 gram, grams) {
+            QHash<quint64, QVector<quint64> >::const_iterator i =
+                    postings.constFind(gram);
+            if (i == postings.constEnd())
+                return matches;
+            if (!rarest || i.value().size() < rarest->size())
+                rarest = &i.value();
+        }
+        foreach (quint64 key, *rarest) {
+            QHash<quint64, QString>::const_iterator i = texts.constFind(key);
+            if (i != texts.constEnd() && i.value().contains(str, cs))
+                matches.append(key);
+        }
+    }
+
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()),
+                  matches.end());
+    return matches;
+}
+
+void SearchIndex::refresh(Sheet *sheet)
+{
+    if (!built) {
+        build(sheet);
+        return;
+    }
+
+    bool reset;
+    QVector<quint64> changed = sheet->takeChangedCells(&reset);
+    if (reset) {
+        build(sheet);
+        return;
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()),
+                  changed.end());
+    foreach (quint64 key, changed)
+        update(sheet, key);
+
+    if (postingCount > 2 * liveCount + 65536)
+        compact();
+}
+
+void SearchIndex::build(Sheet *sheet)
+{
+    clear();
+    built = true;
+
+    // Changes are only logged from here on, so an index nobody uses
+    // costs the sheet nothing.
+    bool reset;
+    sheet->setTrackChanges(true);
+    sheet->takeChangedCells(&reset);
+
+    QVector<quint64> keys;
+    keys.reserve(sheet->cells().count());
+    const CellStore &cells = sheet->cells();
+    for (CellStore::const_iterator i = cells.begin(); i != cells.end(); ++i)
+        keys.append(DependencyGraph::key(i.row(), i.column()));
+
+    texts.reserve(keys.size());
+    foreach (quint64 key, keys)
+        update(sheet, key);
+}
+
+void SearchIndex::update(Sheet *sheet, quint64 key)
+{
+    int row = DependencyGraph::row(key);
+    int column = DependencyGraph::column(key);
+
+    QHash<quint64, QString>::iterator old = texts.find(key);
+    if (old != texts.end()) {
+        liveCount -= trigrams(old.value()).size();
+        texts.erase(old);
+    }
+
+    // A cell being recalculated is logged again once its value lands.
+    if (sheet->isCalculating(row, column))
+        return;
+
+    QString str = sheet->text(row, column);
+    if (str.isEmpty())
+        return;
+
+    texts.insert(key, str);
+    QVector<quint64> grams = trigrams(str);
+    foreach (quint64 gram, grams)
+        postings[gram].append(key);
+    postingCount += grams.size();
+    liveCount += grams.size();
+}
+
+void SearchIndex::compact()
+{
+    postings.clear();
+    postingCount = 0;
+
+    QHash<quint64, QString>::const_iterator i = texts.constBegin();
+    for (; i != texts.constEnd(); ++i) {
+        QVector<quint64> grams = trigrams(i.value());
+        foreach (quint64 gram, grams)
+            postings[gram].append(i.key());
+        postingCount += grams.size();
+    }
+    liveCount = postingCount;
+}
+
+// Trigrams are taken from the case-folded text, so one index serves
+// both case-sensitive and case-insensitive searches; the matches are
+// checked against the real text afterwards.
+QVector<quint64> SearchIndex::trigrams(const QString &str)
+{
+    QVector<quint64> grams;
+    if (str.size() < 3)
+        return grams;
+
+    QString folded = str.toCaseFolded();
+    const ushort *units = folded.utf16();
+    grams.reserve(folded.size() - 2);
+    for (int i = 0; i + 2 < folded.size(); ++i)
+        grams.append((quint64(units[i]) << 32) | (quint64(units[i + 1]) << 16)
+                     | units[i + 2]);
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
@@ -0,0 +1,41 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class Sheet;
+
+// A trigram index over the displayed text of a sheet.  It is built on
+// the first search and then kept up to date from the cells the sheet
+// reports as changed, so a search only looks at the cells sharing the
+// rarest trigram of the pattern instead of evaluating every cell.
+class SearchIndex
+{
+public:
+    SearchIndex();
+
+    QVector<quint64> find(Sheet *sheet, const QString &str,
+                          Qt::CaseSensitivity cs);
+    QString text(quint64 key) const { return texts.value(key); }
+    void clear();
+
+private:
+    void refresh(Sheet *sheet);
+    void build(Sheet *sheet);
+    void update(Sheet *sheet, quint64 key);
+    void compact();
+
+    static QVector<quint64> trigrams(const QString &str);
+
+    bool built;
+    QHash<quint64, QString> texts;
+    // Posting lists only ever grow; entries left behind by edits are
+    // filtered out against the texts and dropped by compact().
+    QHash<quint64, QVector<quint64> > postings;
+    qint64 postingCount;
+    qint64 liveCount;
+};
+
+#endif // SEARCHINDEX_H
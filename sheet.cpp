@@ -0,0 +1,712 @@
+#include "sheet.h"
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThread>
+
+class Sheet::LevelTask : public QRunnable
+{
+public:
+    LevelTask(const Sheet *sheet, const QVector<quint64> &cells,
+              const QSet<quint64> &cyclic, QVector<Value> *values,
+              QVector<Profiler::Event> *events)
+        : sheet(sheet), cells(cells), cyclic(cyclic), values(values),
+          events(events), thread(0), next(new QAtomicInt(0)),
+          done(new QSemaphore) {}
+    LevelTask(const LevelTask &other, int thread)
+        : QRunnable(), sheet(other.sheet), cells(other.cells),
+          cyclic(other.cyclic), values(other.values), events(other.events),
+          thread(thread), next(other.next), done(other.done) {}
+
+    void run()
+    {
+        // Batches are claimed from a shared counter so that fast
+        // threads pick up the work of slow ones.
+        Value *results = values->data();
+        Profiler::Event *timings = events ? events->data() : 0;
+        int size = cells.size();
+        int first;
+        while ((first = next->fetchAndAddRelaxed(LevelBatchSize)) < size
+               && !sheet->isCanceled()) {
+            int last = qMin(first + int(LevelBatchSize), size);
+            for (int i = first; i < last; ++i)
+                results[i] = timings
+                        ? sheet->evaluateProfiled(cells[i], cyclic,
+                                                  &timings[i], thread)
+                        : sheet->evaluateCell(cells[i], cyclic);
+        }
+        if (thread > 0)
+            done->release();
+    }
+
+    void waitForHelpers(int count) { done->acquire(count); }
+
+private:
+    const Sheet *sheet;
+    const QVector<quint64> &cells;
+    const QSet<quint64> &cyclic;
+    QVector<Value> *values;
+    QVector<Profiler::Event> *events;
+    int thread;
+    QSharedPointer<QAtomicInt> next;
+    QSharedPointer<QSemaphore> done;
+};
+
+Sheet::Sheet()
+    : batchDepth(0), autoRecalc(true), deferred(false),
+      trackChanges(false), changesReset(false), trackEdits(false),
+      editsReset(false), canceled(0),
+      pool(new QThreadPool), activeProfiler(0)
+{
+    pool->setMaxThreadCount(QThread::idealThreadCount());
+}
+
+int Sheet::threadCount() const
+{
+    return pool->maxThreadCount();
+}
+
+void Sheet::setThreadCount(int count)
+{
+    pool->setMaxThreadCount(qMax(1, count));
+}
+
+void Sheet::setAutoRecalculate(bool recalc)
+{
+    autoRecalc = recalc;
+    if (autoRecalc) {
+        invalidate();
+        if (!deferred)
+            recalculatePending();
+    }
+}
+
+QString Sheet::formula(int row, int column) const
+{
+    const Cell *c = store.cell(row, column);
+    return c ? c->formula(row, column, store.strings()) : "";
+}
+
+void Sheet::setFormula(int row, int column, const QString &formula)
+{
+    store.setFormula(row, column, formula);
+    updatePrecedents(row, column);
+    cellChanged(DependencyGraph::key(row, column));
+    cellEdited(DependencyGraph::key(row, column));
+
+    QVector<quint64> changed;
+    changed.append(DependencyGraph::key(row, column));
+    if (batchDepth > 0) {
+        batchCells += changed;
+        return;
+    }
+
+    invalidateDependents(changed);
+    if (autoRecalc && !deferred)
+        recalculatePending();
+}
+
+// Puts back a saved cell together with its cached value; nothing is
+// dirtied or evaluated.
+void Sheet::restore(int row, int column, const QString &formula,
+                    const Formula &compiled, const Value &value)
+{
+    store.restore(row, column, formula, compiled, value);
+    updatePrecedents(row, column);
+    cellChanged(DependencyGraph::key(row, column));
+}
+
+// Stores a literal without going through the formula parser.  Bulk
+// imports use this; the graph is only touched when the cell used to
+// hold a formula or something depends on it.
+void Sheet::setValue(int row, int column, const QString &text,
+                     const Value &value)
+{
+    quint64 key = DependencyGraph::key(row, column);
+    const Cell *old = store.cell(row, column);
+    bool hadFormula = old && old->hasFormula();
+
+    store.restore(row, column, text, Formula(), value);
+    cellChanged(key);
+    cellEdited(key);
+    if (hadFormula)
+        graph.setPrecedents(key, QVector<quint64>(), QVector<CellRange>());
+    if (!graph.hasDependents(key))
+        return;
+
+    QVector<quint64> changed;
+    changed.append(key);
+    if (batchDepth > 0) {
+        batchCells += changed;
+        return;
+    }
+
+    invalidateDependents(changed);
+    if (autoRecalc && !deferred)
+        recalculatePending();
+}
+
+// Copies the top row of a range into the rows below it, as one batch.
+// Every copy of a formula shares the original's compiled program, so
+// nothing is parsed however long the range.
+void Sheet::fillDown(const CellRange &range)
+{
+    beginBatch();
+    for (int column = range.left; column <= range.right; ++column) {
+        for (int row = range.top + 1; row <= range.bottom; ++row)
+            copyCell(range.top, column, row, column);
+    }
+    commitBatch();
+}
+
+void Sheet::fillRight(const CellRange &range)
+{
+    beginBatch();
+    for (int row = range.top; row <= range.bottom; ++row) {
+        for (int column = range.left + 1; column <= range.right; ++column)
+            copyCell(row, range.left, row, column);
+    }
+    commitBatch();
+}
+
+void Sheet::copyCell(int fromRow, int fromColumn, int toRow, int toColumn)
+{
+    quint64 key = DependencyGraph::key(toRow, toColumn);
+    store.copy(fromRow, fromColumn, toRow, toColumn);
+    updatePrecedents(toRow, toColumn);
+    cellChanged(key);
+    cellEdited(key);
+    batchCells.append(key);
+}
+
+// Puts back a cell saved earlier, or removes the cell when there is
+// none.  Undo uses this: the cell and its dependents are recalculated
+// like any other edit, but nothing is parsed.
+void Sheet::putCell(int row, int column, const Cell *cell)
+{
+    quint64 key = DependencyGraph::key(row, column);
+    if (cell) {
+        store.put(row, column, *cell);
+    } else {
+        store.remove(row, column);
+    }
+    updatePrecedents(row, column);
+    cellChanged(key);
+    cellEdited(key);
+
+    QVector<quint64> changed;
+    changed.append(key);
+    if (batchDepth > 0) {
+        batchCells += changed;
+        return;
+    }
+
+    invalidateDependents(changed);
+    if (autoRecalc && !deferred)
+        recalculatePending();
+}
+
+// Removes every cell in a range.  The store drops them a chunk at a
+// time; only the formulas among them have precedents to let go of.
+void Sheet::removeRange(const CellRange &range)
+{
+    QVector<quint64> removed;
+    store.usedCells(range, &removed);
+    foreach (quint64 key, removed) {
+        const Cell *c = store.cell(DependencyGraph::row(key),
+                                   DependencyGraph::column(key));
+        if (c->hasFormula())
+            graph.setPrecedents(key, QVector<quint64>(), QVector<CellRange>());
+        cellChanged(key);
+        cellEdited(key);
+    }
+    store.remove(range);
+
+    if (batchDepth > 0) {
+        batchCells += removed;
+        return;
+    }
+
+    invalidateDependents(removed);
+    if (autoRecalc && !deferred)
+        recalculatePending();
+}
+
+// Rearranges the rows of a range so that row i ends up holding what
+// row order[i] held, as a sort does.  References into the moved part
+// of a row follow it; see Formula::moveRow().  Rows that stay put are
+// not touched.
+void Sheet::permuteRows(const CellRange &range, const QVector<int> &order)
+{
+    // Read every moving row before any of them is overwritten.
+    int width = range.right - range.left + 1;
+    QVector<int> moved;
+    QVector<QString> formulas;
+    for (int i = 0; i < order.size(); ++i) {
+        if (order[i] == i)
+            continue;
+        moved.append(i);
+        int from = range.top + order[i];
+        for (int j = 0; j < width; ++j) {
+            QString str = formula(from, range.left + j);
+            if (str.startsWith('='))
+                str = Formula::moveRow(str, from, range.top + i,
+                                       range.left, range.right);
+            formulas.append(str);
+        }
+    }
+
+    beginBatch();
+    for (int i = 0; i < moved.size(); ++i) {
+        for (int j = 0; j < width; ++j)
+            setFormula(range.top + moved[i], range.left + j,
+                       formulas[i * width + j]);
+    }
+    commitBatch();
+}
+
+// Edits made between beginBatch() and the matching commitBatch() only
+// update the store and graph; their dependents are dirtied in a single
+// walk and recalculated once on commit.
+void Sheet::beginBatch()
+{
+    ++batchDepth;
+}
+
+void Sheet::commitBatch()
+{
+    if (batchDepth == 0 || --batchDepth > 0)
+        return;
+
+    invalidateDependents(batchCells);
+    batchCells.clear();
+    if (autoRecalc && !deferred)
+        recalculatePending();
+}
+
+Value Sheet::value(int row, int column)
+{
+    const Cell *c = store.cell(row, column);
+    if (!c)
+        return Value();
+
+    if (store.isDirty(row, column) && !isCalculating(row, column)) {
+        QVector<quint64> cells;
+        cells.append(DependencyGraph::key(row, column));
+        evaluate(cells);
+        c = store.cell(row, column);
+    }
+    return c->value();
+}
+
+QString Sheet::text(int row, int column)
+{
+    if (!store.cell(row, column))
+        return QString();
+
+    if (isCalculating(row, column))
+        return "Calculating...";
+    return format(value(row, column));
+}
+
+QString Sheet::format(const Value &value) const
+{
+    switch (value.type()) {
+    case Value::Number:
+        return QString::number(value.toNumber(), 'g', 15);
+    case Value::String:
+        return store.strings().string(value.stringId());
+    case Value::Boolean:
+        return value.toBool() ? "TRUE" : "FALSE";
+    case Value::Error:
+        return Value::errorText(value.errorCode());
+    default:
+        return QString();
+    }
+}
+
+// In deferred mode dirty cells are left to a background recalculation
+// and show as calculating instead of being evaluated on demand.
+bool Sheet::isCalculating(int row, int column) const
+{
+    return deferred && autoRecalc && store.isDirty(row, column);
+}
+
+void Sheet::clear()
+{
+    store.clear();
+    graph.clear();
+    lookups.clear();
+    pendingCells.clear();
+    batchCells.clear();
+    changedCells.clear();
+    changesReset = trackChanges;
+    editedCells.clear();
+    editsReset = trackEdits;
+}
+
+void Sheet::invalidate()
+{
+    QVector<quint64> cells;
+    for (CellStore::const_iterator i = store.begin(); i != store.end(); ++i) {
+        if (i->hasFormula())
+            cells.append(DependencyGraph::key(i.row(), i.column()));
+    }
+
+    foreach (quint64 key, cells)
+        store.setDirty(DependencyGraph::row(key),
+                       DependencyGraph::column(key));
+    pendingCells = cells;
+}
+
+void Sheet::recalculate()
+{
+    invalidate();
+    recalculatePending();
+}
+
+void Sheet::recalculatePending()
+{
+    evaluate(pendingCells);
+    pendingCells.clear();
+}
+
+QVector<quint64> Sheet::dirtyCells(const CellRange &range) const
+{
+    QVector<quint64> keys;
+    store.dirtyCells(range, &keys);
+    return keys;
+}
+
+// Evaluates the dirty cells of a range, and whatever they depend on,
+// ahead of the rest.  The other pending cells are left for a later
+// recalculatePending().
+void Sheet::recalculateRange(const CellRange &range)
+{
+    evaluate(dirtyCells(range));
+}
+
+// The copy shares the cell chunks and graph with this sheet until
+// either side writes, so it is cheap to take and safe to recalculate
+// on another thread while this sheet keeps serving the view.
+Sheet *Sheet::snapshot() const
+{
+    Sheet *copy = new Sheet;
+    copy->store = store;
+    copy->graph = graph;
+    copy->lookups.share(lookups);
+    copy->pendingCells = pendingCells;
+    copy->autoRecalc = autoRecalc;
+    copy->trackChanges = trackChanges;
+    copy->pool = pool;
+    copy->activeProfiler = activeProfiler;
+    return copy;
+}
+
+// Only valid when this sheet has not been edited since the snapshot
+// was taken: the snapshot's store then differs only in fresh values.
+// Cells the snapshot left pending stay pending here.
+void Sheet::adopt(const Sheet &snapshot)
+{
+    store = snapshot.store;
+    lookups.share(snapshot.lookups);
+    pendingCells = snapshot.pendingCells;
+    foreach (quint64 key, snapshot.changedCells)
+        cellChanged(key);
+    if (snapshot.changesReset) {
+        changedCells.clear();
+        changesReset = trackChanges;
+    }
+}
+
+// Takes over the cells of another sheet, such as one loaded on another
+// thread.  Settings like the thread count stay as they are, and change
+// tracking reports a reset.
+void Sheet::assign(const Sheet &other)
+{
+    store = other.store;
+    graph = other.graph;
+    lookups.clear();
+    pendingCells = other.pendingCells;
+    batchCells.clear();
+    changedCells.clear();
+    changesReset = trackChanges;
+    editedCells.clear();
+    editsReset = trackEdits;
+}
+
+// While tracking is on, every cell whose value may have changed is
+// logged for takeChangedCells().  A log that outgrows the sheet is
+// dropped and reported as a reset instead.
+void Sheet::setTrackChanges(bool track)
+{
+    trackChanges = track;
+    changedCells.clear();
+    changesReset = false;
+}
+
+QVector<quint64> Sheet::takeChangedCells(bool *reset)
+{
+    QVector<quint64> cells;
+    cells.swap(changedCells);
+    *reset = changesReset;
+    changesReset = false;
+    return cells;
+}
+
+// While tracking is on, every cell whose formula or text was edited is
+// collected for takeEditedCells(), so that a save can write just those.
+// clear() reports a reset, after which everything has to be written.
+void Sheet::setTrackEdits(bool track)
+{
+    trackEdits = track;
+    editedCells.clear();
+    editsReset = false;
+}
+
+QVector<quint64> Sheet::takeEditedCells(bool *reset)
+{
+    QVector<quint64> cells;
+    cells.reserve(editedCells.size());
+    foreach (quint64 key, editedCells)
+        cells.append(key);
+    editedCells.clear();
+    *reset = editsReset;
+    editsReset = false;
+    return cells;
+}
+
+void Sheet::cellEdited(quint64 key)
+{
+    if (trackEdits)
+        editedCells.insert(key);
+}
+
+void Sheet::cellChanged(quint64 key)
+{
+    if (!trackChanges || changesReset)
+        return;
+
+    if (changedCells.size() > store.count() + 1024) {
+        changedCells.clear();
+        changesReset = true;
+        return;
+    }
+    changedCells.append(key);
+}
+
+Value Sheet::cellValue(int row, int column) const
+{
+    if (row < 0 || row >= RowCount || column < 0 || column >= ColumnCount)
+        return Value::fromError(Value::BadReference);
+
+    const Cell *c = store.cell(row, column);
+    if (c) {
+        return c->value();
+    } else {
+        return Value::fromNumber(0.0);
+    }
+}
+
+RangeSummary Sheet::summarize(const CellRange &range) const
+{
+    return store.summarize(range);
+}
+
+int Sheet::find(const CellRange &range, const Value &key, bool sorted) const
+{
+    return lookups.find(store, range, key, sorted);
+}
+
+void Sheet::updatePrecedents(int row, int column)
+{
+    QVector<quint64> precedents;
+    QVector<CellRange> ranges;
+    if (const Cell *c = store.cell(row, column)) {
+        foreach (const CellReference &ref, c->references(row, column))
+            precedents.append(DependencyGraph::key(ref.row, ref.column));
+        ranges = c->ranges(row, column);
+    }
+    graph.setPrecedents(DependencyGraph::key(row, column), precedents,
+                        ranges);
+}
+
+void Sheet::invalidateDependents(const QVector<quint64> &changed)
+{
+    if (!autoRecalc)
+        return;
+
+    pendingCells += changed;
+    foreach (quint64 key, graph.dependents(changed)) {
+        if (store.setDirty(DependencyGraph::row(key),
+                           DependencyGraph::column(key)))
+            pendingCells.append(key);
+    }
+}
+
+bool Sheet::isDirty(quint64 key) const
+{
+    return store.isDirty(DependencyGraph::row(key),
+                         DependencyGraph::column(key));
+}
+
+QVector<quint64> Sheet::dirtyPrecedents(quint64 key) const
+{
+    QVector<quint64> precedents = graph.precedents(key);
+    foreach (const CellRange &range, graph.rangePrecedents(key))
+        store.dirtyCells(range, &precedents);
+    return precedents;
+}
+
+void Sheet::evaluate(const QVector<quint64> &cells)
+{
+    enum { Unvisited = -2, Visiting = -1 };
+
+    struct Frame
+    {
+        quint64 key;
+        QVector<quint64> precedents;
+        int next;
+        int level;
+    };
+
+    // Maps each visited cell to Visiting or, once finished, to its
+    // level: one more than the deepest dirty precedent it waits for.
+    QHash<quint64, int> state;
+    QSet<quint64> cyclic;
+    QVector<QVector<quint64> > levels;
+    QVector<Frame> stack;
+
+    foreach (quint64 root, cells) {
+        if (isCanceled())
+            return;
+        if (state.contains(root) || !isDirty(root))
+            continue;
+
+        Frame frame = { root, dirtyPrecedents(root), 0, 0 };
+        stack.append(frame);
+        state.insert(root, Visiting);
+
+        while (!stack.isEmpty()) {
+            Frame &top = stack.last();
+            if (top.next == top.precedents.size()) {
+                quint64 key = top.key;
+                int level = top.level;
+                state.insert(key, level);
+                if (levels.size() <= level)
+                    levels.resize(level + 1);
+                levels[level].append(key);
+                stack.removeLast();
+                if (!stack.isEmpty())
+                    stack.last().level = qMax(stack.last().level, level + 1);
+                continue;
+            }
+
+            quint64 precedent = top.precedents[top.next++];
+            if (!isDirty(precedent))
+                continue;
+
+            int precedentState = state.value(precedent, Unvisited);
+            if (precedentState == Visiting) {
+                for (int i = stack.size() - 1; i >= 0; --i) {
+                    cyclic.insert(stack[i].key);
+                    if (stack[i].key == precedent)
+                        break;
+                }
+            } else if (precedentState == Unvisited) {
+                Frame frame = { precedent, dirtyPrecedents(precedent),
+                                0, 0 };
+                stack.append(frame);
+                state.insert(precedent, Visiting);
+            } else {
+                top.level = qMax(top.level, precedentState + 1);
+            }
+        }
+    }
+
+    qint64 start = activeProfiler ? activeProfiler->now() : 0;
+    int evaluated = 0;
+
+    QVector<Value> values;
+    QVector<Profiler::Event> events;
+    for (int depth = 0; depth < levels.size(); ++depth) {
+        const QVector<quint64> &level = levels[depth];
+        if (isCanceled())
+            return;
+        evaluateLevel(level, cyclic, &values,
+                      activeProfiler ? &events : 0);
+        for (int i = 0; i < level.size(); ++i) {
+            store.setValue(DependencyGraph::row(level[i]),
+                           DependencyGraph::column(level[i]), values[i]);
+            cellChanged(level[i]);
+        }
+
+        if (activeProfiler) {
+            for (int i = 0; i < level.size(); ++i) {
+                events[i].key = level[i];
+                events[i].depth = depth;
+            }
+            activeProfiler->recordLevel(events);
+            evaluated += level.size();
+        }
+    }
+
+    if (activeProfiler && !levels.isEmpty())
+        activeProfiler->recordRecalculation(start, evaluated, levels.size());
+}
+
+Value Sheet::evaluateCell(quint64 key, const QSet<quint64> &cyclic) const
+{
+    if (cyclic.contains(key))
+        return Value::fromError(Value::Cycle);
+
+    int row = DependencyGraph::row(key);
+    int column = DependencyGraph::column(key);
+    return store.cell(row, column)->compiledFormula().evaluate(*this, row,
+                                                               column);
+}
+
+Value Sheet::evaluateProfiled(quint64 key, const QSet<quint64> &cyclic,
+                              Profiler::Event *event, int thread) const
+{
+    event->start = activeProfiler->now();
+    Value value = evaluateCell(key, cyclic);
+    event->duration = activeProfiler->now() - event->start;
+    event->thread = thread;
+    return value;
+}
+
+void Sheet::evaluateLevel(const QVector<quint64> &cells,
+                          const QSet<quint64> &cyclic,
+                          QVector<Value> *values,
+                          QVector<Profiler::Event> *events)
+{
+    values->resize(cells.size());
+    if (events)
+        events->resize(cells.size());
+
+    // Cells within a level never read each other, so they can be
+    // evaluated concurrently against the store, which is only read
+    // until the whole level has been written back.
+    int threads = qMin(pool->maxThreadCount(),
+                       cells.size() / LevelBatchSize);
+    if (threads < 2) {
+        for (int i = 0; i < cells.size(); ++i)
+            (*values)[i] = events
+                    ? evaluateProfiled(cells[i], cyclic, &(*events)[i], 0)
+                    : evaluateCell(cells[i], cyclic);
+        return;
+    }
+
+    // The pool is shared with snapshots of this sheet, so only the
+    // helpers started here are waited for, not the pool as a whole.
+    LevelTask task(this, cells, cyclic, values, events);
+    for (int i = 1; i < threads; ++i)
+        pool->start(new LevelTask(task, i));
+    task.run();
+    task.waitForHelpers(threads - 1);
+}
@@ -0,0 +1,119 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <QAtomicInt>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+#include "cellstore.h"
+#include "dependencygraph.h"
+#include "formula.h"
+#include "lookupcache.h"
+#include "profiler.h"
+
+class Sheet : private FormulaContext
+{
+    class LevelTask;
+
+    enum { LevelBatchSize = 256 };
+
+public:
+    enum { RowCount = CellReference::MaxRows,
+           ColumnCount = CellReference::MaxColumns };
+
+    Sheet();
+
+    bool autoRecalculate() const { return autoRecalc; }
+    void setAutoRecalculate(bool recalc);
+    int threadCount() const;
+    void setThreadCount(int count);
+    bool deferredRecalculation() const { return deferred; }
+    void setDeferredRecalculation(bool defer) { deferred = defer; }
+
+    const CellStore &cells() const { return store; }
+    QString formula(int row, int column) const;
+    void setFormula(int row, int column, const QString &formula);
+    void restore(int row, int column, const QString &formula,
+                 const Formula &compiled, const Value &value);
+    void setValue(int row, int column, const QString &text,
+                  const Value &value);
+    int intern(const QString &str) { return store.intern(str); }
+    void pruneStrings(QBitArray *used) { store.pruneStrings(used); }
+    void fillDown(const CellRange &range);
+    void fillRight(const CellRange &range);
+    void putCell(int row, int column, const Cell *cell);
+    void removeRange(const CellRange &range);
+    void permuteRows(const CellRange &range, const QVector<int> &order);
+    Value value(int row, int column);
+    QString text(int row, int column);
+    QString format(const Value &value) const;
+    bool isCalculating(int row, int column) const;
+    void clear();
+    void invalidate();
+    void recalculate();
+
+    void beginBatch();
+    void commitBatch();
+    bool inBatch() const { return batchDepth > 0; }
+
+    bool hasPendingCells() const { return !pendingCells.isEmpty(); }
+    QVector<quint64> dirtyCells(const CellRange &range) const;
+    void recalculatePending();
+    void recalculateRange(const CellRange &range);
+    Sheet *snapshot() const;
+    void adopt(const Sheet &snapshot);
+    void assign(const Sheet &other);
+    void cancel() { canceled.storeRelease(1); }
+    bool isCanceled() const { return canceled.loadAcquire(); }
+
+    Profiler *profiler() const { return activeProfiler; }
+    void setProfiler(Profiler *profiler) { activeProfiler = profiler; }
+
+    void setTrackChanges(bool track);
+    QVector<quint64> takeChangedCells(bool *reset);
+    void setTrackEdits(bool track);
+    QVector<quint64> takeEditedCells(bool *reset);
+
+private:
+    void cellChanged(quint64 key);
+    void cellEdited(quint64 key);
+    void copyCell(int fromRow, int fromColumn, int toRow, int toColumn);
+    Value cellValue(int row, int column) const;
+    RangeSummary summarize(const CellRange &range) const;
+    int find(const CellRange &range, const Value &key, bool sorted) const;
+    void updatePrecedents(int row, int column);
+    void invalidateDependents(const QVector<quint64> &changed);
+    bool isDirty(quint64 key) const;
+    QVector<quint64> dirtyPrecedents(quint64 key) const;
+    void evaluate(const QVector<quint64> &cells);
+    Value evaluateCell(quint64 key, const QSet<quint64> &cyclic) const;
+    Value evaluateProfiled(quint64 key, const QSet<quint64> &cyclic,
+                           Profiler::Event *event, int thread) const;
+    void evaluateLevel(const QVector<quint64> &cells,
+                       const QSet<quint64> &cyclic,
+                       QVector<Value> *values,
+                       QVector<Profiler::Event> *events);
+
+    CellStore store;
+    DependencyGraph graph;
+    LookupCache lookups;
+    QVector<quint64> pendingCells;
+    QVector<quint64> batchCells;
+    int batchDepth;
+    bool autoRecalc;
+    bool deferred;
+    bool trackChanges;
+    bool changesReset;
+    QVector<quint64> changedCells;
+    bool trackEdits;
+    bool editsReset;
+    QSet<quint64> editedCells;
+    QAtomicInt canceled;
+    QSharedPointer<QThreadPool> pool;
+    Profiler *activeProfiler;
+};
+
+#endif // SHEET_H
@@ -0,0 +1,701 @@
+#include "sheetfile.h"
+#include "sheet.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QMap>
+#include <QSaveFile>
+#include <QStringList>
+
+#include <algorithm>
+
+#include <string.h>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// File layout, all through QDataStream:
+//
+//   header      magic, version, reserved, string table offset,
+//               directory offset
+//   blocks      one per populated column: count, then the rows, text
+//               indexes, value types, numbers, auxiliary ints and
+//               program indexes of its cells, each as its own array;
+//               the number holds a number or boolean value, the
+//               auxiliary int a string index or error code
+//   strings     cell texts and string values, deduplicated
+//   programs    formula bytecode, one entry per shared program
+//   directory   column, cell count and block offset per column
+//   journal     any number of records appended by later saves:
+//               magic, payload size, CRC-32 of the payload and the
+//               payload, which holds a cell count and a (row, column,
+//               text) triple per edited cell, an empty text for a
+//               removed cell
+//
+// Full writes go to a temporary file that replaces the old one only
+// once complete.  Each appended record is synced to disk before the
+// append returns, so a crash leaves at most a torn last record.  It
+// fails its checksum and is skipped when the file is read, which never
+// writes to it; the next append overwrites it.
+//
+// Formula texts are not stored: they are rebuilt from the programs,
+// which are relative to their cells.
+
+namespace {
+
+struct Crc32Table
+{
+    Crc32Table()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+
+    quint32 entries[256];
+};
+
+// The CRC-32 of IEEE 802.3 and zlib.
+quint32 crc32(const char *data, qint64 size)
+{
+    static const Crc32Table table;
+    quint32 crc = 0xffffffff;
+    for (qint64 i = 0; i < size; ++i)
+        crc = table.entries[(crc ^ uchar(data[i])) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Flushes what was written to the file down to the disk.
+bool sync(QFile *file)
+{
+    if (!file->flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(file->handle()) == 0;
+#elif defined(Q_OS_DARWIN)
+    return ::fsync(file->handle()) == 0;
+#else
+    return ::fdatasync(file->handle()) == 0;
+#endif
+}
+
+class StringTable
+{
+public:
+    qint32 index(const QString &str)
+    {
+        QHash<QString, qint32>::const_iterator i = indexes.constFind(str);
+        if (i != indexes.constEnd())
+            return i.value();
+        qint32 n = strings.size();
+        indexes.insert(str, n);
+        strings.append(str);
+        return n;
+    }
+
+    QStringList strings;
+
+private:
+    QHash<QString, qint32> indexes;
+};
+
+class ProgramTable
+{
+public:
+    qint32 index(const Formula &formula)
+    {
+        if (formula.isNull())
+            return -1;
+
+        QString key = formula.relativeForm();
+        QHash<QString, qint32>::const_iterator i = indexes.constFind(key);
+        if (i != indexes.constEnd())
+            return i.value();
+        qint32 n = programs.size();
+        indexes.insert(key, n);
+        programs.append(formula.bytecode());
+        return n;
+    }
+
+    QVector<QByteArray> programs;
+
+private:
+    QHash<QString, qint32> indexes;
+};
+
+// Reads a mapped file in place.  A QBuffer over the mapping would
+// limit files to 2 GiB.
+class MappedDevice : public QIODevice
+{
+public:
+    MappedDevice(const uchar *data, qint64 length)
+        : data(data), length(length) {}
+
+    bool isSequential() const { return false; }
+    qint64 size() const { return length; }
+
+protected:
+    qint64 readData(char *out, qint64 maxSize)
+    {
+        qint64 n = qBound(Q_INT64_C(0), length - pos(), maxSize);
+        memcpy(out, data + pos(), size_t(n));
+        return n;
+    }
+    qint64 writeData(const char *, qint64) { return -1; }
+
+private:
+    const uchar *data;
+    qint64 length;
+};
+
+struct DirectoryEntry
+{
+    qint32 column;
+    quint32 count;
+    quint64 offset;
+};
+
+// Reads the cells of one block into the sheet.  Each field of a block
+// is an array of fixed-width entries, so the first cells of a block
+// can be read without the rest.
+class BlockReader
+{
+public:
+    enum Result { Ok, Corrupt, Canceled };
+    enum { ProgressInterval = 65536 };
+
+    BlockReader(Sheet *sheet, QIODevice *device,
+                SheetFile::Progress *progress)
+        : sheet(sheet), device(device), in(device), progress(progress)
+    {
+        in.setVersion(QDataStream::Qt_5_8);
+    }
+
+    Result read(const DirectoryEntry &entry, int rowLimit);
+    const QString &string(int index);
+
+    QVector<qint64> stringOffsets;
+    QVector<Formula> programs;
+
+private:
+    template <typename T>
+    void readArray(qint64 offset, QVector<T> *array)
+    {
+        device->seek(offset);
+        for (int i = 0; i < array->size(); ++i)
+            in >> (*array)[i];
+    }
+
+    Sheet *sheet;
+    QIODevice *device;
+    QDataStream in;
+    SheetFile::Progress *progress;
+    QVector<QString> strings;
+    QVector<bool> decoded;
+};
+
+// Strings are decoded the first time a cell refers to them, so that a
+// preview does not wait for the whole string table.
+const QString &BlockReader::string(int index)
+{
+    if (strings.isEmpty()) {
+        strings.resize(stringOffsets.size());
+        decoded.resize(stringOffsets.size());
+    }
+    if (!decoded[index]) {
+        qint64 pos = device->pos();
+        device->seek(stringOffsets[index]);
+        in >> strings[index];
+        device->seek(pos);
+        decoded[index] = true;
+    }
+    return strings[index];
+}
+
+// Reads the cells of the block above rowLimit; rows are stored in
+// ascending order.
+BlockReader::Result BlockReader::read(const DirectoryEntry &entry,
+                                      int rowLimit)
+{
+    quint32 count;
+    device->seek(entry.offset);
+    in >> count;
+    if (count != entry.count || qint64(count) > device->size())
+        return Corrupt;
+
+    QVector<qint32> rows;
+    if (rowLimit < Sheet::RowCount) {
+        qint32 row;
+        for (quint32 i = 0; i < count; ++i) {
+            in >> row;
+            if (in.status() != QDataStream::Ok || row >= rowLimit)
+                break;
+            rows.append(row);
+        }
+    } else {
+        rows.resize(count);
+        readArray(entry.offset + 4, &rows);
+    }
+
+    int n = rows.size();
+    qint64 start = qint64(entry.offset) + 4;
+    QVector<qint32> texts(n);
+    QVector<quint8> types(n);
+    QVector<double> numbers(n);
+    QVector<qint32> aux(n);
+    QVector<qint32> indexes(n);
+    readArray(start + 4 * qint64(count), &texts);
+    readArray(start + 8 * qint64(count), &types);
+    readArray(start + 9 * qint64(count), &numbers);
+    readArray(start + 17 * qint64(count), &aux);
+    readArray(start + 21 * qint64(count), &indexes);
+
+    for (int i = 0; i < n; ++i) {
+        if (progress && i % ProgressInterval == ProgressInterval - 1
+                && !progress->progress(device->pos(), device->size()))
+            return Canceled;
+
+        qint32 program = indexes[i];
+        if (in.status() != QDataStream::Ok
+                || rows[i] < 0 || rows[i] >= Sheet::RowCount
+                || entry.column < 0
+                || entry.column >= Sheet::ColumnCount
+                || texts[i] >= stringOffsets.size()
+                || program >= programs.size()) {
+            return Corrupt;
+        }
+
+        int code = aux[i];
+        Value value;
+        switch (types[i]) {
+        case Value::Number:
+            value = Value::fromNumber(numbers[i]);
+            break;
+        case Value::String:
+            if (code >= 0 && code < stringOffsets.size())
+                value = Value::fromString(sheet->intern(string(code)));
+            break;
+        case Value::Boolean:
+            value = Value::fromBool(numbers[i] != 0.0);
+            break;
+        case Value::Error:
+            if (code > Value::NoError && code <= Value::NotAvailable)
+                value = Value::fromError(Value::ErrorCode(code));
+            break;
+        default:
+            break;
+        }
+
+        QString formula;
+        if (texts[i] >= 0)
+            formula = string(texts[i]);
+
+        Formula compiled;
+        if (program >= 0)
+            compiled = programs.at(program);
+        sheet->restore(rows[i], entry.column, formula, compiled, value);
+    }
+
+    if (progress && !progress->progress(device->pos(), device->size()))
+        return Canceled;
+    return in.status() == QDataStream::Ok ? Ok : Corrupt;
+}
+
+}
+
+bool SheetFile::isSheetFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic = 0;
+    in >> magic;
+    return magic == quint32(MagicNumber);
+}
+
+bool SheetFile::write(const Sheet &sheet, const QString &fileName,
+                      QString *errorString, Extent *extent)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    const CellStore &cells = sheet.cells();
+    QMap<int, QVector<int> > columns;
+    for (CellStore::const_iterator i = cells.begin(); i != cells.end(); ++i)
+        columns[i.column()].append(i.row());
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_8);
+    out << quint32(MagicNumber) << quint16(Version) << quint16(0)
+        << quint64(0) << quint64(0);
+
+    StringTable strings;
+    ProgramTable programs;
+    QVector<DirectoryEntry> directory;
+
+    QMap<int, QVector<int> >::iterator column = columns.begin();
+    for (; column != columns.end(); ++column) {
+        QVector<int> &rows = column.value();
+        std::sort(rows.begin(), rows.end());
+
+        DirectoryEntry entry = { column.key(), quint32(rows.size()),
+                                 quint64(file.pos()) };
+        directory.append(entry);
+
+        QVector<const Cell *> block;
+        foreach (int row, rows)
+            block.append(cells.cell(row, column.key()));
+
+        out << entry.count;
+        foreach (int row, rows)
+            out << qint32(row);
+
+        for (int i = 0; i < block.size(); ++i) {
+            // Formulas and plain numbers are rebuilt on load.
+            const Cell *cell = block[i];
+            if (cell->hasFormula()) {
+                out << qint32(-1);
+                continue;
+            }
+
+            QString formula = cell->formula(rows[i], column.key(),
+                                            cells.strings());
+            Value value = cell->value();
+            if (value.isNumber()
+                    && QString::number(value.toNumber(), 'g', 15) == formula) {
+                out << qint32(-1);
+            } else {
+                out << strings.index(formula);
+            }
+        }
+
+        foreach (const Cell *cell, block)
+            out << quint8(cell->value().type());
+
+        foreach (const Cell *cell, block) {
+            Value value = cell->value();
+            if (value.isNumber()) {
+                out << value.toNumber();
+            } else if (value.isBool()) {
+                out << (value.toBool() ? 1.0 : 0.0);
+            } else {
+                out << 0.0;
+            }
+        }
+
+        foreach (const Cell *cell, block) {
+            Value value = cell->value();
+            if (value.isString()) {
+                out << strings.index(cells.strings().string(value.stringId()));
+            } else if (value.isError()) {
+                out << qint32(value.errorCode());
+            } else {
+                out << qint32(0);
+            }
+        }
+
+        foreach (const Cell *cell, block)
+            out << programs.index(cell->compiledFormula());
+    }
+
+    quint64 stringTableOffset = file.pos();
+    out << quint32(strings.strings.size());
+    foreach (const QString &str, strings.strings)
+        out << str;
+    out << quint32(programs.programs.size());
+    foreach (const QByteArray &bytecode, programs.programs)
+        out << bytecode;
+
+    quint64 directoryOffset = file.pos();
+    out << quint32(directory.size());
+    foreach (const DirectoryEntry &entry, directory)
+        out << entry.column << entry.count << entry.offset;
+
+    qint64 end = file.pos();
+    file.seek(8);
+    out << stringTableOffset << directoryOffset;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        *errorString = file.errorString();
+        return false;
+    }
+    if (extent) {
+        extent->base = end;
+        extent->end = end;
+    }
+    return true;
+}
+
+// Appends the current texts of the given cells as one journal record
+// at extent->end, cutting off whatever follows there, such as a record
+// torn by a crash.  Fails without touching the file when it is not the
+// one the extent was taken from as far as can be told; the caller then
+// writes the whole sheet instead.
+bool SheetFile::append(const Sheet &sheet, const QVector<quint64> &cells,
+                       const QString &fileName, Extent *extent,
+                       QString *errorString)
+{
+    if (extent->end < 0) {
+        *errorString = QObject::tr("The file has no journal");
+        return false;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadWrite)) {
+        *errorString = file.errorString();
+        return false;
+    }
+    if (file.size() < extent->end || !isSheetFile(fileName)) {
+        *errorString = QObject::tr("The file has changed on disk");
+        return false;
+    }
+
+    QByteArray payload;
+    QDataStream record(&payload, QIODevice::WriteOnly);
+    record.setVersion(QDataStream::Qt_5_8);
+    record << quint32(cells.size());
+    foreach (quint64 key, cells) {
+        int row = DependencyGraph::row(key);
+        int column = DependencyGraph::column(key);
+        record << qint32(row) << qint32(column)
+               << sheet.formula(row, column);
+    }
+
+    if (!file.resize(extent->end) || !file.seek(extent->end)) {
+        *errorString = file.errorString();
+        return false;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_8);
+    out << quint32(JournalMagic) << quint32(payload.size())
+        << crc32(payload.constData(), payload.size());
+    out.writeRawData(payload.constData(), payload.size());
+
+    if (out.status() != QDataStream::Ok || !sync(&file)) {
+        *errorString = file.errorString();
+        return false;
+    }
+    extent->end = file.pos();
+    return true;
+}
+
+bool SheetFile::read(Sheet *sheet, const QString &fileName,
+                     QString *errorString, Extent *extent,
+                     Progress *progress)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    // Map the file and read it in place; the blocks are then parsed
+    // straight out of the page cache instead of through read() copies.
+    // Where the file cannot be mapped it is read through QFile.
+    uchar *mapped = file.map(0, file.size());
+    MappedDevice mappedDevice(mapped, file.size());
+    QIODevice *device = &file;
+    if (mapped) {
+        mappedDevice.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+        device = &mappedDevice;
+    }
+    QDataStream in(device);
+    in.setVersion(QDataStream::Qt_5_8);
+
+    quint32 magic;
+    quint16 version;
+    quint16 reserved;
+    quint64 stringTableOffset;
+    quint64 directoryOffset;
+    in >> magic >> version >> reserved >> stringTableOffset
+       >> directoryOffset;
+    if (magic != quint32(MagicNumber)) {
+        *errorString = QObject::tr("Not a spreadsheet file");
+        return false;
+    }
+    if (version > Version) {
+        *errorString = QObject::tr("The file was written by a newer version");
+        return false;
+    }
+    if (version < Version) {
+        *errorString = QObject::tr("The file is corrupt");
+        return false;
+    }
+
+    // Only the lengths of the strings are read here.  QDataStream
+    // writes a QString as its size in bytes, all ones for a null one,
+    // followed by its UTF-16 data.
+    BlockReader reader(sheet, device, progress);
+    quint32 stringCount;
+    device->seek(stringTableOffset);
+    in >> stringCount;
+    for (quint32 i = 0; i < stringCount && in.status() == QDataStream::Ok;
+         ++i) {
+        reader.stringOffsets.append(device->pos());
+        quint32 bytes;
+        in >> bytes;
+        if (bytes == 0xffffffff)
+            continue;
+        if (bytes > device->size() - device->pos())
+            in.setStatus(QDataStream::ReadCorruptData);
+        else
+            device->seek(device->pos() + bytes);
+    }
+
+    // Every program is decoded once and shared by all its cells.
+    quint32 programCount;
+    in >> programCount;
+    for (quint32 i = 0; i < programCount && in.status() == QDataStream::Ok;
+         ++i) {
+        QByteArray bytecode;
+        in >> bytecode;
+        reader.programs.append(Formula::fromBytecode(bytecode));
+    }
+
+    QVector<DirectoryEntry> directory;
+    quint32 columnCount;
+    device->seek(directoryOffset);
+    in >> columnCount;
+    for (quint32 i = 0; i < columnCount && in.status() == QDataStream::Ok;
+         ++i) {
+        DirectoryEntry entry;
+        in >> entry.column >> entry.count >> entry.offset;
+        directory.append(entry);
+    }
+    qint64 base = device->pos();
+
+    if (in.status() != QDataStream::Ok) {
+        *errorString = QObject::tr("The file is corrupt");
+        return false;
+    }
+
+    // The top-left corner is read first, so that it can be shown while
+    // the rest follows.  Its cells are simply read again later.
+    BlockReader::Result result = BlockReader::Ok;
+    if (progress) {
+        foreach (const DirectoryEntry &entry, directory) {
+            if (entry.column < PreviewColumns && result == BlockReader::Ok)
+                result = reader.read(entry, PreviewRows);
+        }
+        if (result == BlockReader::Ok)
+            progress->preview(*sheet);
+    }
+    foreach (const DirectoryEntry &entry, directory) {
+        if (result == BlockReader::Ok)
+            result = reader.read(entry, Sheet::RowCount);
+    }
+
+    if (result == BlockReader::Canceled) {
+        *errorString = QObject::tr("Loading was canceled");
+        return false;
+    }
+    if (result == BlockReader::Corrupt) {
+        *errorString = QObject::tr("The file is corrupt");
+        return false;
+    }
+
+    qint64 end = readJournal(sheet, device, base);
+    if (extent) {
+        extent->base = base;
+        extent->end = end;
+    }
+    return true;
+}
+
+// Replays the journal records that follow the sheet at offset base and
+// returns where the last intact one ends.
+qint64 SheetFile::readJournal(Sheet *sheet, QIODevice *device,
+                              qint64 base)
+{
+    QDataStream in(device);
+    in.setVersion(QDataStream::Qt_5_8);
+    device->seek(base);
+
+    qint64 end = base;
+    sheet->beginBatch();
+    for (;;) {
+        quint32 magic;
+        quint32 size;
+        quint32 checksum;
+        in >> magic >> size >> checksum;
+        qint64 start = end + 12;
+        if (in.status() != QDataStream::Ok || magic != quint32(JournalMagic)
+                || size > quint64(device->size() - start))
+            break;
+
+        QByteArray payload = device->read(size);
+        if (payload.size() != int(size))
+            break;
+        if (crc32(payload.constData(), size) != checksum)
+            break;
+
+        QDataStream record(payload);
+        record.setVersion(QDataStream::Qt_5_8);
+        quint32 count;
+        record >> count;
+        for (quint32 i = 0; i < count && record.status() == QDataStream::Ok;
+             ++i) {
+            qint32 row;
+            qint32 column;
+            QString text;
+            record >> row >> column >> text;
+            if (record.status() == QDataStream::Ok
+                    && row >= 0 && row < Sheet::RowCount
+                    && column >= 0 && column < Sheet::ColumnCount)
+                sheet->setFormula(row, column, text);
+        }
+
+        end = start + size;
+    }
+    sheet->commitBatch();
+    return end;
+}
+
+// Reads the original headerless format of (row, column, formula)
+// records, re-entering every formula.
+bool SheetFile::importLegacy(Sheet *sheet, const QString &fileName,
+                             QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_8);
+
+    quint32 row;
+    quint32 column;
+    QString str;
+
+    sheet->beginBatch();
+    while (!in.atEnd()) {
+        in >> row >> column >> str;
+        if (in.status() != QDataStream::Ok)
+            break;
+        if (row < quint32(Sheet::RowCount)
+                && column < quint32(Sheet::ColumnCount))
+            sheet->setFormula(row, column, str);
+    }
+    sheet->commitBatch();
+
+    if (in.status() != QDataStream::Ok) {
+        *errorString = QObject::tr("The file is corrupt");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef SHEETFILE_H
+#define SHEETFILE_H
+
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+class Sheet;
+
+// Reads and writes the versioned binary workbook format.  Cells are
+// stored column by column with their compiled formulas and cached
+// values, so a sheet can be opened without evaluating anything.
+// Edits can then be appended to a journal at the end of the file
+// instead of rewriting it.
+class SheetFile
+{
+public:
+    enum { MagicNumber = 0x53505358, Version = 1,
+           JournalMagic = 0x5350534a, PreviewRows = 200,
+           PreviewColumns = 50 };
+
+    // Follows a read on another thread.  progress() is called every so
+    // often and cancels the read by returning false; preview() is
+    // called once the first rows and columns are in, before the rest.
+    class Progress
+    {
+    public:
+        virtual ~Progress() {}
+        virtual bool progress(qint64 done, qint64 total) = 0;
+        virtual void preview(const Sheet &sheet) = 0;
+    };
+
+    // Where the written sheet ends and where the valid part of its
+    // journal ends, which is where the next append goes.  The end is
+    // -1 until the sheet has been read from or written to a file.
+    struct Extent
+    {
+        Extent() : base(0), end(-1) {}
+
+        qint64 base;
+        qint64 end;
+    };
+
+    static bool isSheetFile(const QString &fileName);
+    static bool read(Sheet *sheet, const QString &fileName,
+                     QString *errorString, Extent *extent = 0,
+                     Progress *progress = 0);
+    static bool write(const Sheet &sheet, const QString &fileName,
+                      QString *errorString, Extent *extent = 0);
+    static bool append(const Sheet &sheet, const QVector<quint64> &cells,
+                       const QString &fileName, Extent *extent,
+                       QString *errorString);
+    static bool importLegacy(Sheet *sheet, const QString &fileName,
+                             QString *errorString);
+
+private:
+    static qint64 readJournal(Sheet *sheet, QIODevice *device,
+                              qint64 base);
+};
+
+#endif // SHEETFILE_H
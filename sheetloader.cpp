@@ -0,0 +1,117 @@
+#include "sheetloader.h"
+#include "csvfile.h"
+#include "sheet.h"
+
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+SheetLoader::SheetLoader(QObject *parent)
+    : QObject(parent), sheetFile(false), loading(0), loaded(0), canceled(0),
+      percent(-1), previewSheet(0)
+{
+    connect(&watcher, SIGNAL(finished()), this, SLOT(readFinished()));
+}
+
+SheetLoader::~SheetLoader()
+{
+    if (loading) {
+        cancel();
+        watcher.waitForFinished();
+        delete loading;
+    }
+    delete loaded;
+    delete previewSheet;
+}
+
+// Starts reading a file; a read already running is canceled and its
+// result dropped.  Nothing is recalculated on the worker thread: the
+// cells that need it are left pending in the sheet.
+void SheetLoader::start(const QString &fileName)
+{
+    if (loading) {
+        cancel();
+        watcher.waitForFinished();
+        delete loading;
+        loading = 0;
+    }
+    delete loaded;
+    loaded = 0;
+    delete takePreview();
+
+    file = fileName;
+    sheetFile = SheetFile::isSheetFile(fileName);
+    error.clear();
+    fileExtent = SheetFile::Extent();
+    canceled.storeRelease(0);
+    percent.storeRelease(-1);
+
+    loading = new Sheet;
+    loading->setDeferredRecalculation(true);
+    watcher.setFuture(QtConcurrent::run(this, &SheetLoader::read));
+}
+
+void SheetLoader::cancel()
+{
+    canceled.storeRelease(1);
+}
+
+Sheet *SheetLoader::takePreview()
+{
+    QMutexLocker locker(&mutex);
+    Sheet *sheet = previewSheet;
+    previewSheet = 0;
+    return sheet;
+}
+
+Sheet *SheetLoader::takeSheet()
+{
+    Sheet *sheet = loaded;
+    loaded = 0;
+    return sheet;
+}
+
+void SheetLoader::readFinished()
+{
+    if (!loading || !watcher.isFinished())
+        return;
+
+    bool ok = watcher.result() && !isCanceled();
+    if (ok) {
+        loaded = loading;
+    } else {
+        delete loading;
+    }
+    loading = 0;
+    emit finished(ok);
+}
+
+// Runs on the worker thread.  Delimited text and the old format have
+// no preview; their progress comes from how far the file has been read.
+bool SheetLoader::read()
+{
+    if (sheetFile)
+        return SheetFile::read(loading, file, &error, &fileExtent, this);
+    if (CsvFile::isDelimited(file))
+        return CsvFile::read(loading, file, CsvFile::separatorFor(file),
+                             &error, this);
+    return SheetFile::importLegacy(loading, file, &error);
+}
+
+bool SheetLoader::progress(qint64 done, qint64 total)
+{
+    int now = total > 0 ? int(100 * done / total) : 0;
+    if (percent.fetchAndStoreRelaxed(now) != now)
+        emit progressChanged(now);
+    return !isCanceled();
+}
+
+void SheetLoader::preview(const Sheet &sheet)
+{
+    Sheet *copy = sheet.snapshot();
+    {
+        QMutexLocker locker(&mutex);
+        delete previewSheet;
+        previewSheet = copy;
+    }
+    emit previewReady();
+}
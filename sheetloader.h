@@ -0,0 +1,64 @@
+#ifndef SHEETLOADER_H
+#define SHEETLOADER_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+
+#include "sheetfile.h"
+
+class Sheet;
+
+// Reads a file into a sheet of its own on a worker thread.  The cells
+// of the top-left corner are handed out as a preview as soon as they
+// are in, and progress is reported while the rest follows.  The sheet
+// and the preview are taken over by the caller.
+class SheetLoader : public QObject, private SheetFile::Progress
+{
+    Q_OBJECT
+
+public:
+    SheetLoader(QObject *parent = 0);
+    ~SheetLoader();
+
+    void start(const QString &fileName);
+    void cancel();
+    bool isRunning() const { return loading != 0; }
+    bool isCanceled() const { return canceled.loadAcquire(); }
+    QString fileName() const { return file; }
+    QString errorString() const { return error; }
+    bool isSheetFile() const { return sheetFile; }
+    SheetFile::Extent extent() const { return fileExtent; }
+    Sheet *takePreview();
+    Sheet *takeSheet();
+
+signals:
+    void previewReady();
+    void progressChanged(int percent);
+    void finished(bool ok);
+
+private slots:
+    void readFinished();
+
+private:
+    bool read();
+    bool progress(qint64 done, qint64 total);
+    void preview(const Sheet &sheet);
+
+    QString file;
+    bool sheetFile;
+    QString error;
+    SheetFile::Extent fileExtent;
+    QFutureWatcher<bool> watcher;
+    Sheet *loading;
+    Sheet *loaded;
+    QAtomicInt canceled;
+    QAtomicInt percent;
+
+    QMutex mutex;
+    Sheet *previewSheet;
+};
+
+#endif // SHEETLOADER_H
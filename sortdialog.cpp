@@ -1,3 +1,4 @@
+#include "cellreference.h"
 #include "sortdialog.h"
 
 SortDialog::SortDialog(QWidget *parent) :
@@ -8,10 +9,10 @@ SortDialog::SortDialog(QWidget *parent) :
     tertiaryGroupBox->hide();
     layout()->setSizeConstraint(QLayout::SetFixedSize);
 
-    setColumnRange('A', 'Z');
+    setColumnRange(0, 25);
 }
 
-void SortDialog::setColumnRange(QChar first, QChar last)
+void SortDialog::setColumnRange(int first, int last)
 {
     primaryColumnCombo->clear();
     secondaryColumnCombo->clear();
@@ -22,11 +23,10 @@ void SortDialog::setColumnRange(QChar first, QChar last)
 
     primaryColumnCombo->setMinimumSize(secondaryColumnCombo->sizeHint());
 
-    QChar ch = first;
-    while(ch <= last) {
-        primaryColumnCombo->addItem(QString(ch));
-        secondaryColumnCombo->addItem(QString(ch));
-        tertiaryColumnCombo->addItem(QString(ch));
-        ch = ch.unicode() + 1;
+    for (int column = first; column <= last; ++column) {
+        QString name = CellReference::columnName(column);
+        primaryColumnCombo->addItem(name);
+        secondaryColumnCombo->addItem(name);
+        tertiaryColumnCombo->addItem(name);
     }
 }
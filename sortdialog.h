@@ -10,7 +10,7 @@ class SortDialog : public QDialog, public Ui::SortDialog
 
 public:
     SortDialog(QWidget *parent = 0);
-    void setColumnRange(QChar first, QChar last);
+    void setColumnRange(int first, int last);
 };
 
 #endif // SORTDIALOG_H
@@ -1,5 +1,8 @@
-#include "cell.h"
+#include "csvfile.h"
+#include "rowsorter.h"
+#include "sheet.h"
 #include "spreadsheet.h"
+#include "spreadsheetmodel.h"
 
 #include <QFile>
 #include <QDataStream>
@@ -7,67 +10,114 @@
 #include <QMessageBox>
 #include <QApplication>
 #include <QClipboard>
+#include <QScrollBar>
+
+#include <algorithm>
 
 Spreadsheet::Spreadsheet(QWidget *parent)   // OK
-    : QTableWidget(parent)
+    : QTableView(parent)
 {
-    autoRecalc = true;
-
-    setItemPrototype(new Cell);
+    sheetModel = new SpreadsheetModel(this);
+    sheet = sheetModel->sheet();
+    setModel(sheetModel);
     setSelectionMode(ContiguousSelection);
 
-    connect(this, SIGNAL(itemChanged(QTableWidgetItem *)),
+    connect(sheetModel,
+            SIGNAL(dataChanged(QModelIndex, QModelIndex, QVector<int>)),
             this, SLOT(somethingChanged()));
+    connect(sheetModel, SIGNAL(recalculated()),
+            viewport(), SLOT(update()));
+    connect(sheetModel, SIGNAL(recalculated()),
+            this, SIGNAL(recalculated()));
+    connect(sheetModel, SIGNAL(loadProgress(int)),
+            this, SIGNAL(readProgress(int)));
+    connect(sheetModel, SIGNAL(loaded(bool, const QString &)),
+            this, SLOT(loaded(bool, const QString &)));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)),
+            this, SLOT(verticalScrolled(int)));
+    connect(horizontalScrollBar(), SIGNAL(valueChanged(int)),
+            this, SLOT(horizontalScrolled(int)));
 
     clear();
 }
 
 void Spreadsheet::clear()   //OK
 {
-    setRowCount(0);
-    setColumnCount(0);
-    setRowCount(RowCount);
-    setColumnCount(ColumnCount);
+    sheetModel->clear();
+    setCurrentCell(0, 0);
+}
 
-    for (int i = 0; i < ColumnCount; ++i) {
-        QTableWidgetItem *item = new QTableWidgetItem;
-        item->setText(QString(QChar('A' + i)));
-        setHorizontalHeaderItem(i, item);
-    }
+bool Spreadsheet::autoRecalculate() const
+{
+    return sheet->autoRecalculate();
+}
 
-    setCurrentCell(0, 0);
+int Spreadsheet::threadCount() const
+{
+    return sheet->threadCount();
 }
 
-Cell *Spreadsheet::getCell(int row, int column) const   // OK
+void Spreadsheet::setCurrentCell(int row, int column)
 {
-    return static_cast<Cell *>(item(row, column));
+    sheetModel->ensureExtent(row, column);
+    setCurrentIndex(sheetModel->index(row, column));
+}
+
+void Spreadsheet::verticalScrolled(int value)
+{
+    if (value == verticalScrollBar()->maximum())
+        sheetModel->growRows();
+    updateVisibleRange();
+}
+
+void Spreadsheet::horizontalScrolled(int value)
+{
+    if (value == horizontalScrollBar()->maximum())
+        sheetModel->growColumns();
+    updateVisibleRange();
+}
+
+void Spreadsheet::resizeEvent(QResizeEvent *event)
+{
+    QTableView::resizeEvent(event);
+    updateVisibleRange();
+}
+
+// Tells the model which cells are on screen so that they are
+// recalculated first.
+void Spreadsheet::updateVisibleRange()
+{
+    int top = rowAt(0);
+    int left = columnAt(0);
+    int bottom = rowAt(viewport()->height() - 1);
+    int right = columnAt(viewport()->width() - 1);
+    if (bottom < 0)
+        bottom = sheetModel->rowCount() - 1;
+    if (right < 0)
+        right = sheetModel->columnCount() - 1;
+
+    CellRange range = { qMax(top, 0), qMax(left, 0), bottom, right };
+    sheetModel->setVisibleRange(range);
 }
 
 QString Spreadsheet::text(int row, int column) const    // OK
 {
-    Cell *c = getCell(row, column);
-    return c ? c->text() : "";
+    return sheet->text(row, column);
 }
 
 QString Spreadsheet::formula(int row, int column) const // OK
 {
-    Cell *c = getCell(row, column);
-    return c ? c->formula() : "";
+    return sheet->formula(row, column);
 }
 
 void Spreadsheet::setFormula(int row, int column, const QString &formula) // OK
 {
-    Cell *c = getCell(row, column);
-    if (!c) {
-        c = new Cell;
-        setItem(row, column, c);
-    }
-    c->setFormula(formula);
+    sheetModel->setFormula(row, column, formula);
 }
 
 QString Spreadsheet::currentLocation() const    // OK
 {
-    return QChar('A' + currentColumn())
+    return CellReference::columnName(currentColumn())
             + QString::number(currentRow() + 1);
 }
 
@@ -76,135 +126,253 @@ QString Spreadsheet::currentFormula() const // OK
     return formula(currentRow(), currentColumn());
 }
 
+void Spreadsheet::currentChanged(const QModelIndex &current,
+                                 const QModelIndex &previous)
+{
+    QTableView::currentChanged(current, previous);
+    emit currentCellChanged(current.row(), current.column(),
+                            previous.row(), previous.column());
+}
+
 void Spreadsheet::somethingChanged()    // OK
 {
-    if (autoRecalc)
-        recalculate();
+    if (autoRecalculate())
+        viewport()->update();
     emit modified();
 }
 
 bool Spreadsheet::writeFile(const QString &fileName)    // OK
 {
-    QFile file(fileName);
-    if (!file.open(QIODevice::WriteOnly)) {
+    QString errorString;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool ok = sheetModel->save(fileName, &errorString);
+    QApplication::restoreOverrideCursor();
+
+    if (!ok) {
         QMessageBox::warning(this, tr("Spreadsheet"),
                              tr("Cannot write file %1:\n%2")
-                             .arg(file.fileName())
-                             .arg(file.errorString()));
-        return false;
+                             .arg(fileName)
+                             .arg(errorString));
     }
+    return ok;
+}
 
-    QDataStream out(&file);
-    out.setVersion(QDataStream::Qt_5_8);
+// Writes the displayed values as delimited text; formulas are lost.
+// Pending cells are evaluated first so that no placeholder text ends
+// up in the file.
+bool Spreadsheet::exportFile(const QString &fileName)
+{
+    QString errorString;
 
     QApplication::setOverrideCursor(Qt::WaitCursor);
-    for (int row = 0; row < RowCount; ++row) {
-        for (int column = 0; column < ColumnCount; ++column) {
-            QString str = formula(row, column);
-            if (!str.isEmpty())
-                out << row << column << str;
-        }
-    }
+    sheetModel->finishRecalculation();
+    bool ok = CsvFile::write(sheet, fileName, CsvFile::separatorFor(fileName),
+                             &errorString);
     QApplication::restoreOverrideCursor();
-    return true;
-}
 
-bool Spreadsheet::readFile(const QString &fileName) //OK
-{
-    QFile file(fileName);
-    if (!file.open(QIODevice::ReadOnly)) {
+    if (!ok) {
         QMessageBox::warning(this, tr("Spreadsheet"),
-                             tr("Cannot read file %1:\n%2")
-                             .arg(file.fileName())
-                             .arg(file.errorString()));
-        return false;
+                             tr("Cannot write file %1:\n%2")
+                             .arg(fileName)
+                             .arg(errorString));
     }
+    return ok;
+}
 
-    QDataStream in(&file);
-    in.setVersion(QDataStream::Qt_5_8);
+// Starts reading a file in the background; fileRead() reports when it
+// is done.  The top-left cells show up while the rest is read.
+void Spreadsheet::readFile(const QString &fileName)
+{
+    readFileName = fileName;
+    sheetModel->load(fileName);
+    setCurrentCell(0, 0);
+}
 
-    clear();
+bool Spreadsheet::isReading() const
+{
+    return sheetModel->isLoading();
+}
 
-    quint32 row;
-    quint32 column;
-    QString str;
+void Spreadsheet::cancelReading()
+{
+    sheetModel->cancelLoading();
+}
 
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    while (!in.atEnd()) {
-        in >> row >> column >> str;
-        setFormula(row, column, str);
+// A canceled read comes without an error.
+void Spreadsheet::loaded(bool ok, const QString &errorString)
+{
+    if (!ok && !errorString.isEmpty()) {
+        QMessageBox::warning(this, tr("Spreadsheet"),
+                             tr("Cannot read file %1:\n%2")
+                             .arg(readFileName)
+                             .arg(errorString));
     }
-
-    QApplication::restoreOverrideCursor();
-    return true;
+    emit fileRead(ok);
 }
 
 void Spreadsheet::cut() // OK
 {
+    sheetModel->beginBatch(tr("Cut"));
     copy();
     del();
+    sheetModel->commitBatch();
 }
 
 void Spreadsheet::copy()    // OK
 {
-    QTableWidgetSelectionRange range = selectedRange();
+    QItemSelectionRange range = selectedRange();
+    if (!range.isValid())
+        return;
 
     QString str;
 
-    for (int i = 0; i < range.rowCount(); ++i) {
+    for (int i = 0; i < range.height(); ++i) {
         if (i > 0)
             str += "\n";
-        for (int j = 0; j < range.columnCount(); ++j) {
+        for (int j = 0; j < range.width(); ++j) {
              if (j > 0)
                  str += "\t";
-             str += formula(range.topRow() + i, range.leftColumn() + j);
+             str += formula(range.top() + i, range.left() + j);
         }
     }
     QApplication::clipboard()->setText(str);
 }
 
-QTableWidgetSelectionRange Spreadsheet::selectedRange() const   // OK
+QItemSelectionRange Spreadsheet::selectedRange() const   // OK
 {
-    QList<QTableWidgetSelectionRange> ranges = selectedRanges();
-    if (ranges.isEmpty())
-        return QTableWidgetSelectionRange();
-    return ranges.first();
+    QItemSelection selection = selectionModel()->selection();
+    if (selection.isEmpty())
+        return QItemSelectionRange();
+    return selection.first();
+}
+
+// Sums up the numbers in the selection range by range from the
+// store's chunk summaries, so even a whole-column selection does not
+// visit its cells.  Cells in overlapping ranges count once per range.
+RangeSummary Spreadsheet::selectionSummary() const
+{
+    RangeSummary total;
+    foreach (const QItemSelectionRange &range, selectionModel()->selection()) {
+        CellRange cells = { range.top(), range.left(), range.bottom(),
+                            range.right() };
+        RangeSummary summary = sheet->cells().summarize(cells);
+        total.sum += summary.sum;
+        total.min = qMin(total.min, summary.min);
+        total.max = qMax(total.max, summary.max);
+        total.count += summary.count;
+    }
+    return total;
 }
 
 void Spreadsheet::paste()   // OK
 {
-    QTableWidgetSelectionRange range = selectedRange();
+    QItemSelectionRange range = selectedRange();
+    if (!range.isValid())
+        return;
+
     QString str = QApplication::clipboard()->text();
     QStringList rows = str.split('\n');
     int numRows = rows.count();
     int numColumns = rows.first().count('\t') + 1;
 
-    if (range.rowCount() * range.columnCount() != 1
-            && (range.rowCount() != numRows
-                || range.columnCount() != numColumns)) {
+    if (range.height() * range.width() != 1
+            && (range.height() != numRows
+                || range.width() != numColumns)) {
         QMessageBox::information(this, tr("Spreadsheet"),
             tr("The information cannot be pasted because the copy "
                "and paste areas aren’t the same size."));
         return;
     }
 
+    sheetModel->beginBatch(tr("Paste"));
     for (int i = 0; i < numRows; ++i) {
         QStringList columns = rows[i].split('\t');
-        for (int j = 0; j < numColumns; ++j) {
-            int row = range.topRow() + i;
-            int column = range.leftColumn() + j;
-            if (row < RowCount && column < ColumnCount)
+        for (int j = 0; j < numColumns && j < columns.count(); ++j) {
+            int row = range.top() + i;
+            int column = range.left() + j;
+            if (row < Sheet::RowCount && column < Sheet::ColumnCount)
                 setFormula(row, column, columns[j]);
         }
     }
-    somethingChanged();
+    sheetModel->commitBatch();
 }
 
 void Spreadsheet::del() // OK
 {
-    foreach (QTableWidgetItem *item, selectedItems()) {
-       delete item;
+    QItemSelection selection = selectionModel()->selection();
+    if (selection.isEmpty())
+        return;
+
+    sheetModel->beginBatch(tr("Delete"));
+    foreach (const QItemSelectionRange &range, selection) {
+        CellRange cells = { range.top(), range.left(), range.bottom(),
+                            range.right() };
+        sheetModel->removeRange(cells);
     }
+    sheetModel->commitBatch();
+}
+
+void Spreadsheet::fillDown()
+{
+    QItemSelectionRange range = selectedRange();
+    if (!range.isValid() || range.height() < 2)
+        return;
+
+    CellRange cells = { range.top(), range.left(), range.bottom(),
+                        range.right() };
+    sheetModel->fill(cells, Qt::Vertical);
+}
+
+void Spreadsheet::fillRight()
+{
+    QItemSelectionRange range = selectedRange();
+    if (!range.isValid() || range.width() < 2)
+        return;
+
+    CellRange cells = { range.top(), range.left(), range.bottom(),
+                        range.right() };
+    sheetModel->fill(cells, Qt::Horizontal);
+}
+
+void Spreadsheet::undo()
+{
+    sheetModel->undo();
+}
+
+void Spreadsheet::redo()
+{
+    sheetModel->redo();
+}
+
+bool Spreadsheet::canUndo() const
+{
+    return sheetModel->undoJournal()->canUndo();
+}
+
+bool Spreadsheet::canRedo() const
+{
+    return sheetModel->undoJournal()->canRedo();
+}
+
+QString Spreadsheet::undoText() const
+{
+    return sheetModel->undoJournal()->undoText();
+}
+
+QString Spreadsheet::redoText() const
+{
+    return sheetModel->undoJournal()->redoText();
+}
+
+qint64 Spreadsheet::undoMemoryLimit() const
+{
+    return sheetModel->undoJournal()->memoryLimit();
+}
+
+void Spreadsheet::setUndoMemoryLimit(qint64 bytes)
+{
+    sheetModel->undoJournal()->setMemoryLimit(bytes);
 }
 
 void Spreadsheet::selectCurrentRow()    // OK
@@ -219,107 +387,114 @@ void Spreadsheet::selectCurrentColumn() // OK
 
 void Spreadsheet::findNext(const QString& str, Qt::CaseSensitivity cs) // OK
 {
-    int row = currentRow();
-    int column = currentColumn() + 1;
-
-    while (row < RowCount) {
-        while (column < ColumnCount) {
-            if (text(row, column).contains(str, cs)) {
-                clearSelection();
-                setCurrentCell(row, column);
-                activateWindow();
-                return;
-             }
-             ++column;
-         }
-         column = 0;
-         ++row;
-    }
-    QMessageBox::warning(this, "Unsuccessful search",
-                         "Could not find anything by your request");
+    find(str, cs, false);
 }
 
 void Spreadsheet::findPrevious(const QString &str, Qt::CaseSensitivity cs) // OK
 {
+    find(str, cs, true);
+}
 
-    int row = currentRow();
-    int column = currentColumn() - 1;
+void Spreadsheet::find(const QString &str, Qt::CaseSensitivity cs,
+                       bool backward)
+{
+    // Matches come back in key order, which is row-major, so the next
+    // one is a binary search away from the current cell.
+    QVector<quint64> matches = searchIndex.find(sheet, str, cs);
+    quint64 current = DependencyGraph::key(currentRow(), currentColumn());
+
+    QVector<quint64>::const_iterator i;
+    if (backward) {
+        i = std::lower_bound(matches.constBegin(), matches.constEnd(),
+                             current);
+        i = (i == matches.constBegin()) ? matches.constEnd() : i - 1;
+    } else {
+        i = std::upper_bound(matches.constBegin(), matches.constEnd(),
+                             current);
+    }
 
-    while (row >= 0) {
-        while (column >= 0) {
-            if (text(row, column).contains(str, cs)) {
-                clearSelection();
-                setCurrentCell(row, column);
-                activateWindow();
-                return;
-            }
-            --column;
-        }
-        column = ColumnCount - 1;
-        --row;
+    if (i != matches.constEnd()) {
+        clearSelection();
+        setCurrentCell(DependencyGraph::row(*i), DependencyGraph::column(*i));
+        activateWindow();
+        return;
     }
     QMessageBox::warning(this, "Unsuccessful search",
                          "Could not find anything by your request");
 }
 
-void Spreadsheet::recalculate() // OK
+QVector<CellReference> Spreadsheet::findAll(const QString &str,
+                                            Qt::CaseSensitivity cs,
+                                            QStringList *texts)
 {
-    for (int row = 0; row < RowCount; ++row) {
-        for (int column = 0; column < ColumnCount; ++column) {
-            if (getCell(row, column))
-                getCell(row, column)->setDirty();
-        }
+    QVector<CellReference> cells;
+    foreach (quint64 key, searchIndex.find(sheet, str, cs)) {
+        CellReference ref = { DependencyGraph::row(key),
+                              DependencyGraph::column(key) };
+        cells.append(ref);
+        texts->append(searchIndex.text(key));
     }
+    return cells;
+}
+
+void Spreadsheet::recalculate() // OK
+{
+    sheetModel->recalculate();
     viewport()->update();
 }
 
 void Spreadsheet::setAutoRecalculate(bool recalc)   // OK
 {
-    autoRecalc = recalc;
-    if (autoRecalc)
-        recalculate();
+    sheetModel->setAutoRecalculate(recalc);
+    if (recalc)
+        viewport()->update();
 }
 
-void Spreadsheet::sort(const SpreadsheetCompare &compare)   // OK
+void Spreadsheet::setThreadCount(int count)
 {
-    QList<QStringList> rows;
-    QTableWidgetSelectionRange range = selectedRange();
-    int i;
+    sheet->setThreadCount(count);
+}
 
-    for (i = 0; i < range.rowCount(); ++i) {
-        QStringList row;
-        for (int j = 0; j < range.columnCount(); ++j)
-            row.append(formula(range.topRow() + i,
-                               range.leftColumn() + j));
-        rows.append(row);
-    }
+Profiler *Spreadsheet::profiler() const
+{
+    return sheetModel->profiler();
+}
 
-    std::sort(rows.begin(), rows.end(), compare);
+void Spreadsheet::setProfiling(bool on)
+{
+    sheetModel->setProfiling(on);
+}
 
-    for (i = 0; i < range.rowCount(); ++i) {
-        for (int j = 0; j < range.columnCount(); ++j)
-            setFormula(range.topRow() + i, range.leftColumn() + j,
-                       rows[i][j]);
-    }
+void Spreadsheet::setHeatMap(bool on)
+{
+    sheetModel->setHeatMap(on);
+    viewport()->update();
+}
 
-    clearSelection();
-    somethingChanged();
-}
-
-bool SpreadsheetCompare::operator ()(const QStringList &row1,
-                                     const QStringList &row2) const
-{
-    for (int i = 0; i < KeyCount; ++i) {
-        int column = keys[i];
-        if (column != -1) {
-            if (row1[column] != row2[column]) {
-                if (ascending[i]) {
-                    return row1[column] < row2[column];
-                } else {
-                    return row1[column] > row2[column];
-                }
-            }
+void Spreadsheet::sort(const SpreadsheetCompare &compare)   // OK
+{
+    QItemSelectionRange range = selectedRange();
+    if (!range.isValid())
+        return;
+
+    CellRange cells = { range.top(), range.left(), range.bottom(),
+                        range.right() };
+    QVector<RowSorter::Key> keys;
+    for (int i = 0; i < SpreadsheetCompare::KeyCount; ++i) {
+        if (compare.keys[i] != -1) {
+            RowSorter::Key key = { range.left() + compare.keys[i],
+                                   compare.ascending[i] };
+            keys.append(key);
         }
     }
-    return false;
+
+    // The keys are read from the cached values, which must not be
+    // waiting on a background recalculation.
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    sheetModel->finishRecalculation();
+    QVector<int> order = RowSorter::sort(sheet, cells, keys);
+    sheetModel->permuteRows(cells, order);
+    QApplication::restoreOverrideCursor();
+
+    clearSelection();
 }
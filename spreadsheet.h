@@ -1,60 +1,110 @@
 #ifndef SPREADSHEET_H
 #define SPREADSHEET_H
 
-#include <QTableWidget>
+#include <QItemSelectionRange>
+#include <QTableView>
 
-class Cell;
+#include "cellreference.h"
+#include "formula.h"
+#include "searchindex.h"
+
+class Profiler;
+class Sheet;
 class SpreadsheetCompare;
+class SpreadsheetModel;
 
-class Spreadsheet :public QTableWidget
+class Spreadsheet :public QTableView
 {
     Q_OBJECT
 
 public:
     Spreadsheet(QWidget *parent = 0);
 
-    bool    autoRecalculate() const { return autoRecalc; }
+    bool    autoRecalculate() const;
+    Profiler *profiler() const;
+    int     threadCount() const;
     QString currentLocation() const;
     QString currentFormula() const;
-    QTableWidgetSelectionRange selectedRange() const;
+    bool    canUndo() const;
+    bool    canRedo() const;
+    QString undoText() const;
+    QString redoText() const;
+    qint64  undoMemoryLimit() const;
+    void    setUndoMemoryLimit(qint64 bytes);
+    int     currentRow() const { return currentIndex().row(); }
+    int     currentColumn() const { return currentIndex().column(); }
+    void    setCurrentCell(int row, int column);
+    QItemSelectionRange selectedRange() const;
+    RangeSummary selectionSummary() const;
     void clear();
-    bool readFile(const QString &fileName);
+    void readFile(const QString &fileName);
+    bool isReading() const;
     bool writeFile(const QString &fileName);
+    bool exportFile(const QString &fileName);
     void sort(const SpreadsheetCompare &compare);
+    QVector<CellReference> findAll(const QString &str,
+                                   Qt::CaseSensitivity cs,
+                                   QStringList *texts);
 
 public slots:
+    void undo();
+    void redo();
     void cut();
     void copy();
     void paste();
     void del();
+    void fillDown();
+    void fillRight();
     void selectCurrentRow();
     void selectCurrentColumn();
     void recalculate();
     void setAutoRecalculate(bool recalc);
+    void setThreadCount(int count);
+    void setProfiling(bool on);
+    void setHeatMap(bool on);
     void findNext(const QString &str, Qt::CaseSensitivity cs);
     void findPrevious(const QString &str, Qt::CaseSensitivity cs);
+    void cancelReading();
 
 signals:
     void modified();
+    void recalculated();
+    void readProgress(int percent);
+    void fileRead(bool ok);
+    void currentCellChanged(int currentRow, int currentColumn,
+                            int previousRow, int previousColumn);
+
+protected:
+    void resizeEvent(QResizeEvent *event);
+
+protected slots:
+    void currentChanged(const QModelIndex &current,
+                        const QModelIndex &previous);
 
 private slots:
     void somethingChanged();
+    void loaded(bool ok, const QString &errorString);
+    void verticalScrolled(int value);
+    void horizontalScrolled(int value);
 
 private:
-    enum { RowCount = 999, ColumnCount = 26 };
-    Cell    *getCell(int row, int column) const;
     QString text(int row, int column) const;
     QString formula(int row, int column) const;
     void    setFormula(int row, int column, const QString &formula);
+    void    find(const QString &str, Qt::CaseSensitivity cs, bool backward);
+    void    updateVisibleRange();
 
-    bool autoRecalc;
+    SpreadsheetModel *sheetModel;
+    Sheet *sheet;
+    SearchIndex searchIndex;
+    QString readFileName;
 };
 
+// The sort keys chosen in the sort dialog: column offsets within the
+// selection, -1 for an unused key.
 class SpreadsheetCompare
 {
 public:
-    bool operator()(const QStringList &row1,
-                    const QStringList &row2) const;
     enum { KeyCount = 3 };
     int keys[KeyCount];
     bool ascending[KeyCount];
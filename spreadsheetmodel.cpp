@@ -0,0 +1,614 @@
+#include "spreadsheetmodel.h"
+#include "sheet.h"
+#include "sheetfile.h"
+
+#include <QColor>
+#include <QScopedPointer>
+#include <QtConcurrent>
+
+#include <limits.h>
+
+SpreadsheetModel::SpreadsheetModel(QObject *parent)
+    : QAbstractTableModel(parent), rows(RowStep), columns(ColumnStep),
+      snapshot(0), generation(0), snapshotGeneration(0), heatMap(false),
+      compactionSheet(0), batchDepth(0)
+{
+    CellRange none = { 0, 0, -1, -1 };
+    visibleRange = none;
+
+    engine = new Sheet;
+    engine->setDeferredRecalculation(true);
+    engine->setTrackEdits(true);
+
+    connect(&watcher, SIGNAL(finished()),
+            this, SLOT(recalculationFinished()));
+    connect(&compactionWatcher, SIGNAL(finished()),
+            this, SLOT(compactionFinished()));
+    connect(&loader, SIGNAL(previewReady()), this, SLOT(loadPreview()));
+    connect(&loader, SIGNAL(progressChanged(int)),
+            this, SIGNAL(loadProgress(int)));
+    connect(&loader, SIGNAL(finished(bool)), this, SLOT(loadFinished(bool)));
+}
+
+SpreadsheetModel::~SpreadsheetModel()
+{
+    if (snapshot) {
+        snapshot->cancel();
+        watcher.waitForFinished();
+        delete snapshot;
+    }
+    finishCompaction();
+    delete engine;
+}
+
+int SpreadsheetModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows;
+}
+
+int SpreadsheetModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : columns;
+}
+
+QVariant SpreadsheetModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || !engine->cells().cell(index.row(), index.column()))
+        return QVariant();
+
+    if (role == Qt::DisplayRole) {
+        return displayText(index.row(), index.column());
+    } else if (role == Qt::EditRole) {
+        return engine->formula(index.row(), index.column());
+    } else if (role == Qt::BackgroundRole && heatMap) {
+        // Shades from white to red by the time spent evaluating the
+        // cell, relative to the slowest cell profiled so far.
+        Profiler::CellStats stats = recalcProfiler.cellStats(
+                DependencyGraph::key(index.row(), index.column()));
+        qint64 slowest = recalcProfiler.slowestCell();
+        if (stats.evaluations == 0 || slowest == 0)
+            return QVariant();
+        int shade = 255 - int(200 * stats.nanoseconds / slowest);
+        return QColor(255, shade, shade);
+    } else if (role == Qt::TextAlignmentRole) {
+        if (engine->value(index.row(), index.column()).isString()) {
+            return int(Qt::AlignLeft | Qt::AlignVCenter);
+        } else {
+            return int(Qt::AlignRight | Qt::AlignVCenter);
+        }
+    }
+    return QVariant();
+}
+
+// Formatting a number costs more than anything else in painting a
+// cell, so the text is kept with the value it was made from and reused
+// for as long as the cell holds that value.  The cache is simply
+// dropped when it outgrows a few screenfuls.
+QString SpreadsheetModel::displayText(int row, int column) const
+{
+    if (engine->isCalculating(row, column))
+        return engine->text(row, column);
+
+    Value value = engine->value(row, column);
+    quint64 key = DependencyGraph::key(row, column);
+    QHash<quint64, DisplayText>::const_iterator i =
+            displayTexts.constFind(key);
+    if (i != displayTexts.constEnd() && i->value == value)
+        return i->text;
+
+    if (displayTexts.size() >= MaxDisplayTexts)
+        displayTexts.clear();
+    DisplayText entry = { value, engine->format(value) };
+    displayTexts.insert(key, entry);
+    return entry.text;
+}
+
+bool SpreadsheetModel::setData(const QModelIndex &index,
+                               const QVariant &value, int role)
+{
+    if (!index.isValid() || role != Qt::EditRole || isLoading())
+        return false;
+
+    setFormula(index.row(), index.column(), value.toString());
+    return true;
+}
+
+QVariant SpreadsheetModel::headerData(int section,
+                                      Qt::Orientation orientation,
+                                      int role) const
+{
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole)
+        return CellReference::columnName(section);
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+Qt::ItemFlags SpreadsheetModel::flags(const QModelIndex &index) const
+{
+    // Edits made while a file loads would be lost when it is in.
+    if (isLoading())
+        return QAbstractTableModel::flags(index);
+    return QAbstractTableModel::flags(index) | Qt::ItemIsEditable;
+}
+
+void SpreadsheetModel::setFormula(int row, int column, const QString &formula)
+{
+    if (isLoading())
+        return;
+
+    journal.beginGroup();
+    journal.record(*engine, row, column);
+    engine->setFormula(row, column, formula);
+    journal.endGroup(*engine, tr("Edit"));
+    ++generation;
+
+    if (batchDepth > 0) {
+        batchTop = qMin(batchTop, row);
+        batchLeft = qMin(batchLeft, column);
+        batchBottom = qMax(batchBottom, row);
+        batchRight = qMax(batchRight, column);
+        return;
+    }
+
+    ensureExtent(row, column);
+
+    QModelIndex changed = index(row, column);
+    emit dataChanged(changed, changed);
+
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+}
+
+// Fills a range from its top row or, horizontally, from its left
+// column.  The range is announced as one change, like a batch.
+void SpreadsheetModel::fill(const CellRange &range,
+                            Qt::Orientation orientation)
+{
+    if (isLoading())
+        return;
+
+    CellRange targets = range;
+    journal.beginGroup();
+    if (orientation == Qt::Vertical) {
+        ++targets.top;
+        journal.record(*engine, targets);
+        engine->fillDown(range);
+        journal.endGroup(*engine, tr("Fill Down"));
+    } else {
+        ++targets.left;
+        journal.record(*engine, targets);
+        engine->fillRight(range);
+        journal.endGroup(*engine, tr("Fill Right"));
+    }
+    rangeChanged(range);
+}
+
+// Deletes the cells of a range.  Only the cells that exist are
+// recorded for undo, so clearing whole columns stays cheap.
+void SpreadsheetModel::removeRange(const CellRange &range)
+{
+    if (isLoading())
+        return;
+
+    QVector<quint64> keys;
+    engine->cells().usedCells(range, &keys);
+    journal.beginGroup();
+    foreach (quint64 key, keys)
+        journal.record(*engine, DependencyGraph::row(key),
+                       DependencyGraph::column(key));
+    engine->removeRange(range);
+    journal.endGroup(*engine, tr("Delete"));
+
+    if (batchDepth > 0) {
+        ++generation;
+        batchTop = qMin(batchTop, range.top);
+        batchLeft = qMin(batchLeft, range.left);
+        batchBottom = qMax(batchBottom, range.bottom);
+        batchRight = qMax(batchRight, range.right);
+        return;
+    }
+    rangeChanged(range);
+}
+
+// Moves rows as a sort does; the undo journal keeps the permutation
+// rather than the cells.
+void SpreadsheetModel::permuteRows(const CellRange &range,
+                                   const QVector<int> &order)
+{
+    if (isLoading())
+        return;
+
+    journal.recordPermutation(*engine, range, order, tr("Sort"));
+    engine->permuteRows(range, order);
+    rangeChanged(range);
+}
+
+void SpreadsheetModel::undo()
+{
+    if (!isLoading())
+        rangeChanged(journal.undo(engine));
+}
+
+void SpreadsheetModel::redo()
+{
+    if (!isLoading())
+        rangeChanged(journal.redo(engine));
+}
+
+void SpreadsheetModel::rangeChanged(const CellRange &range)
+{
+    ++generation;
+    if (range.bottom >= 0) {
+        ensureExtent(range.bottom, range.right);
+        emit dataChanged(index(range.top, range.left),
+                         index(range.bottom, range.right));
+    }
+
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+}
+
+// Batched edits are announced as one changed rectangle and trigger a
+// single recalculation when the outermost batch is committed.  They
+// are undone as one step, named by the text of the outermost batch.
+void SpreadsheetModel::beginBatch(const QString &text)
+{
+    if (batchDepth++ == 0) {
+        batchTop = batchLeft = INT_MAX;
+        batchBottom = batchRight = -1;
+        batchText = text;
+    }
+    engine->beginBatch();
+    journal.beginGroup();
+}
+
+void SpreadsheetModel::commitBatch()
+{
+    if (batchDepth == 0)
+        return;
+
+    engine->commitBatch();
+    journal.endGroup(*engine, batchText);
+    if (--batchDepth > 0)
+        return;
+
+    if (batchBottom >= 0) {
+        ensureExtent(batchBottom, batchRight);
+        emit dataChanged(index(batchTop, batchLeft),
+                         index(batchBottom, batchRight));
+    }
+
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+}
+
+bool SpreadsheetModel::isProfiling() const
+{
+    return engine->profiler() != 0;
+}
+
+// Profiling starts from a clean slate.  A recalculation already running
+// keeps reporting to the profiler it started with.
+void SpreadsheetModel::setProfiling(bool on)
+{
+    if (on && !isProfiling())
+        recalcProfiler.clear();
+    engine->setProfiler(on ? &recalcProfiler : 0);
+}
+
+void SpreadsheetModel::setAutoRecalculate(bool recalc)
+{
+    cancelRecalculation();
+    engine->setAutoRecalculate(recalc);
+    if (recalc)
+        scheduleRecalculation();
+}
+
+void SpreadsheetModel::recalculate()
+{
+    if (engine->autoRecalculate()) {
+        cancelRecalculation();
+        engine->invalidate();
+        scheduleRecalculation();
+    } else {
+        engine->recalculate();
+    }
+}
+
+void SpreadsheetModel::clear()
+{
+    beginResetModel();
+    cancelRecalculation();
+    finishCompaction();
+    if (isLoading())
+        loader.cancel();
+    engine->clear();
+    displayTexts.clear();
+    journal.clear();
+    savedFile.clear();
+    rows = RowStep;
+    columns = ColumnStep;
+    endResetModel();
+}
+
+// Starts loading a file on a worker thread, starting from an empty
+// sheet.  The top-left cells are shown as soon as they are read and the
+// rest once the whole file is in; the sheet cannot be edited meanwhile.
+// Saved sheets come with their cached values, so nothing is
+// recalculated; other formats are recalculated as a batch of edits.
+void SpreadsheetModel::load(const QString &fileName)
+{
+    clear();
+    loader.start(fileName);
+}
+
+void SpreadsheetModel::cancelLoading()
+{
+    if (isLoading())
+        loader.cancel();
+}
+
+void SpreadsheetModel::loadPreview()
+{
+    QScopedPointer<Sheet> preview(loader.takePreview());
+    if (!preview || !isLoading())
+        return;
+
+    beginResetModel();
+    cancelRecalculation();
+    engine->assign(*preview);
+    displayTexts.clear();
+    endResetModel();
+    fitExtent();
+}
+
+// The loaded sheet replaces the preview without a reset, so the view
+// keeps its position if it has been scrolled meanwhile.
+void SpreadsheetModel::loadFinished(bool ok)
+{
+    QScopedPointer<Sheet> sheet(loader.takeSheet());
+    cancelRecalculation();
+    if (ok) {
+        engine->assign(*sheet);
+        if (loader.isSheetFile()) {
+            savedFile = loader.fileName();
+            savedExtent = loader.extent();
+        }
+        displayTexts.clear();
+        fitExtent();
+        emit dataChanged(index(0, 0), index(rows - 1, columns - 1));
+    } else {
+        beginResetModel();
+        engine->clear();
+        displayTexts.clear();
+        rows = RowStep;
+        columns = ColumnStep;
+        endResetModel();
+    }
+    engine->setTrackEdits(true);
+
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+    emit loaded(ok, loader.isCanceled() ? QString() : loader.errorString());
+}
+
+// Saves just the cells edited since the sheet was last loaded from or
+// saved to the same file, as a record appended to the file's journal.
+// Anything else, and edits touching most of the sheet, rewrite the
+// whole file.  Once the journal has grown larger than the sheet, the
+// file is compacted by a full rewrite in the background.
+bool SpreadsheetModel::save(const QString &fileName, QString *errorString)
+{
+    if (isLoading()) {
+        *errorString = tr("The file is still being loaded");
+        return false;
+    }
+    finishCompaction();
+    // Values are saved as clean, so none may be left pending.
+    finishRecalculation();
+
+    bool reset;
+    QVector<quint64> cells = engine->takeEditedCells(&reset);
+    if (!reset && fileName == savedFile
+            && qint64(cells.size()) * 2 <= engine->cells().count()
+            && SheetFile::append(*engine, cells, fileName, &savedExtent,
+                                 errorString)) {
+        qint64 journalSize = savedExtent.end - savedExtent.base;
+        if (journalSize > qMax(qint64(MinCompactionSize), savedExtent.base))
+            startCompaction();
+        return true;
+    }
+
+    if (!SheetFile::write(*engine, fileName, errorString, &savedExtent)) {
+        savedFile.clear();
+        return false;
+    }
+    savedFile = fileName;
+    pruneStrings();
+    return true;
+}
+
+static bool compact(Sheet *sheet, const QString &fileName,
+                    SheetFile::Extent *extent)
+{
+    QString errorString;
+    return SheetFile::write(*sheet, fileName, &errorString, extent);
+}
+
+// Rewrites the saved file from a snapshot taken right after a save,
+// which therefore holds exactly what the file does.  Edits made in the
+// meantime are still tracked and go to the new file's journal.
+void SpreadsheetModel::startCompaction()
+{
+    pruneStrings();
+    compactionSheet = engine->snapshot();
+    compactionWatcher.setFuture(QtConcurrent::run(compact, compactionSheet,
+                                                  savedFile,
+                                                  &compactionExtent));
+}
+
+// Texts and string values stay in the sheet's string pool after their
+// cells change, so the pool is pruned whenever the whole file is
+// rewritten anyway.  Snapshots keep their own copy of the pool, but the
+// display cache compares ids that may now be handed out again.
+void SpreadsheetModel::pruneStrings()
+{
+    QBitArray used(engine->cells().strings().count());
+    journal.markStrings(&used);
+    engine->pruneStrings(&used);
+    displayTexts.clear();
+}
+
+// Waits for a running compaction; nothing may be appended to the file
+// while it is being replaced.
+void SpreadsheetModel::finishCompaction()
+{
+    if (!compactionSheet)
+        return;
+    compactionWatcher.waitForFinished();
+    compactionFinished();
+}
+
+void SpreadsheetModel::compactionFinished()
+{
+    if (!compactionSheet || !compactionWatcher.isFinished())
+        return;
+
+    // A failed compaction leaves the old file and its journal intact.
+    if (compactionWatcher.result())
+        savedExtent = compactionExtent;
+    delete compactionSheet;
+    compactionSheet = 0;
+}
+
+// The model only exposes the populated part of the sheet plus a margin;
+// it grows in steps as the user scrolls and doubles when a distant cell
+// is written, so the headers never track the full 1048576 x 16384 grid.
+void SpreadsheetModel::ensureExtent(int row, int column)
+{
+    int newRows = rows;
+    int newColumns = columns;
+    if (row >= rows)
+        newRows = qMax(row + 1 + RowStep, 2 * rows);
+    if (column >= columns)
+        newColumns = qMax(column + 1 + ColumnStep, 2 * columns);
+    setExtent(newRows, newColumns);
+}
+
+void SpreadsheetModel::growRows()
+{
+    setExtent(rows + RowStep, columns);
+}
+
+void SpreadsheetModel::growColumns()
+{
+    setExtent(rows, columns + ColumnStep);
+}
+
+// The cells on screen are recalculated ahead of the rest of the sheet.
+void SpreadsheetModel::setVisibleRange(const CellRange &range)
+{
+    visibleRange = range;
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+}
+
+// Grows the extent to the populated part of the sheet plus a margin.
+void SpreadsheetModel::fitExtent()
+{
+    int newRows = rows;
+    int newColumns = columns;
+    const CellStore &cells = engine->cells();
+    for (CellStore::const_iterator i = cells.begin(); i != cells.end(); ++i) {
+        newRows = qMax(newRows, i.row() + 1 + RowStep);
+        newColumns = qMax(newColumns, i.column() + 1 + ColumnStep);
+    }
+    setExtent(newRows, newColumns);
+}
+
+void SpreadsheetModel::setExtent(int newRows, int newColumns)
+{
+    newRows = qMin(newRows, int(Sheet::RowCount));
+    newColumns = qMin(newColumns, int(Sheet::ColumnCount));
+
+    if (newRows > rows) {
+        beginInsertRows(QModelIndex(), rows, newRows - 1);
+        rows = newRows;
+        endInsertRows();
+    }
+    if (newColumns > columns) {
+        beginInsertColumns(QModelIndex(), columns, newColumns - 1);
+        columns = newColumns;
+        endInsertColumns();
+    }
+}
+
+// Only one recalculation runs at a time.  An edit made while it runs
+// bumps the generation and cancels it; when it finishes its results
+// are dropped and a new one is started from the current state.
+//
+// When dirty cells are on screen they get a pass of their own first,
+// which is adopted and painted before the rest of the sheet follows.
+void SpreadsheetModel::scheduleRecalculation()
+{
+    if (!engine->hasPendingCells())
+        return;
+
+    if (snapshot) {
+        if (snapshotGeneration != generation)
+            snapshot->cancel();
+        return;
+    }
+
+    snapshot = engine->snapshot();
+    snapshotGeneration = generation;
+    if (!engine->dirtyCells(visibleRange).isEmpty()) {
+        watcher.setFuture(QtConcurrent::run(snapshot,
+                                            &Sheet::recalculateRange,
+                                            visibleRange));
+    } else {
+        watcher.setFuture(QtConcurrent::run(snapshot,
+                                            &Sheet::recalculatePending));
+    }
+}
+
+void SpreadsheetModel::cancelRecalculation()
+{
+    ++generation;
+    if (snapshot)
+        snapshot->cancel();
+}
+
+// Brings every value up to date before it is read as data, by
+// evaluating the pending cells on this thread.  A background pass that
+// is still running is dropped.
+void SpreadsheetModel::finishRecalculation()
+{
+    if (snapshot) {
+        cancelRecalculation();
+        watcher.waitForFinished();
+        delete snapshot;
+        snapshot = 0;
+    }
+    if (engine->autoRecalculate() && engine->hasPendingCells()) {
+        engine->recalculatePending();
+        emit recalculated();
+    }
+}
+
+void SpreadsheetModel::recalculationFinished()
+{
+    if (!snapshot || !watcher.isFinished())
+        return;
+
+    Sheet *finished = snapshot;
+    snapshot = 0;
+
+    if (snapshotGeneration == generation && !finished->isCanceled()) {
+        engine->adopt(*finished);
+        emit recalculated();
+    }
+    delete finished;
+
+    if (engine->autoRecalculate())
+        scheduleRecalculation();
+}
@@ -0,0 +1,126 @@
+#ifndef SPREADSHEETMODEL_H
+#define SPREADSHEETMODEL_H
+
+#include <QAbstractTableModel>
+#include <QFutureWatcher>
+#include <QHash>
+
+#include "cellreference.h"
+#include "profiler.h"
+#include "sheetfile.h"
+#include "sheetloader.h"
+#include "undojournal.h"
+#include "value.h"
+
+class Sheet;
+
+class SpreadsheetModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum { RowStep = 1000, ColumnStep = 26, MaxDisplayTexts = 65536,
+           MinCompactionSize = 1 << 20 };
+
+    SpreadsheetModel(QObject *parent = 0);
+    ~SpreadsheetModel();
+
+    Sheet *sheet() const { return engine; }
+    Profiler *profiler() { return &recalcProfiler; }
+    UndoJournal *undoJournal() { return &journal; }
+    bool isProfiling() const;
+    void setProfiling(bool on);
+    bool showsHeatMap() const { return heatMap; }
+    void setHeatMap(bool on) { heatMap = on; }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    bool setData(const QModelIndex &index, const QVariant &value, int role);
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+
+    void setFormula(int row, int column, const QString &formula);
+    void fill(const CellRange &range, Qt::Orientation orientation);
+    void removeRange(const CellRange &range);
+    void permuteRows(const CellRange &range, const QVector<int> &order);
+    void beginBatch(const QString &text);
+    void commitBatch();
+    void undo();
+    void redo();
+    void setAutoRecalculate(bool recalc);
+    void recalculate();
+    void finishRecalculation();
+    void clear();
+    void load(const QString &fileName);
+    void cancelLoading();
+    bool isLoading() const { return loader.isRunning(); }
+    bool save(const QString &fileName, QString *errorString);
+    void ensureExtent(int row, int column);
+    void growRows();
+    void growColumns();
+    void setVisibleRange(const CellRange &range);
+
+signals:
+    void recalculated();
+    void loadProgress(int percent);
+    void loaded(bool ok, const QString &errorString);
+
+private slots:
+    void recalculationFinished();
+    void compactionFinished();
+    void loadPreview();
+    void loadFinished(bool ok);
+
+private:
+    struct DisplayText
+    {
+        Value value;
+        QString text;
+    };
+
+    QString displayText(int row, int column) const;
+    void setExtent(int newRows, int newColumns);
+    void fitExtent();
+    void rangeChanged(const CellRange &range);
+    void scheduleRecalculation();
+    void cancelRecalculation();
+    void startCompaction();
+    void pruneStrings();
+    void finishCompaction();
+
+    Sheet *engine;
+    int rows;
+    int columns;
+    CellRange visibleRange;
+    mutable QHash<quint64, DisplayText> displayTexts;
+
+    QFutureWatcher<void> watcher;
+    Sheet *snapshot;
+    quint64 generation;
+    quint64 snapshotGeneration;
+
+    Profiler recalcProfiler;
+    bool heatMap;
+
+    UndoJournal journal;
+    SheetLoader loader;
+
+    // The file the sheet was last loaded from or saved to, while the
+    // edits since then can be appended to its journal.
+    QString savedFile;
+    SheetFile::Extent savedExtent;
+    QFutureWatcher<bool> compactionWatcher;
+    Sheet *compactionSheet;
+    SheetFile::Extent compactionExtent;
+
+    int batchDepth;
+    QString batchText;
+    int batchTop;
+    int batchLeft;
+    int batchBottom;
+    int batchRight;
+};
+
+#endif // SPREADSHEETMODEL_H
@@ -0,0 +1,43 @@
+#include "stringpool.h"
+
+int StringPool::intern(const QString &str)
+{
+    QHash<QString, int>::const_iterator i = ids.constFind(str);
+    if (i != ids.constEnd())
+        return i.value();
+
+    int id;
+    if (freeIds.isEmpty()) {
+        id = strings.size();
+        strings.append(str);
+    } else {
+        id = freeIds.takeLast();
+        strings[id] = str;
+    }
+    ids.insert(str, id);
+    return id;
+}
+
+// Drops every string whose bit in used is clear.  The caller marks the
+// ids of everything that still holds any.
+void StringPool::prune(const QBitArray &used)
+{
+    QHash<QString, int>::iterator i = ids.begin();
+    while (i != ids.end()) {
+        int id = i.value();
+        if (id < used.size() && used.testBit(id)) {
+            ++i;
+            continue;
+        }
+        strings[id] = QString();
+        freeIds.append(id);
+        i = ids.erase(i);
+    }
+}
+
+void StringPool::clear()
+{
+    strings.clear();
+    ids.clear();
+    freeIds.clear();
+}
@@ -0,0 +1,28 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// Interns the string values of a sheet so that cells and the evaluator
+// can pass them around as plain ids.  Ids stay valid until prune()
+// drops the strings nothing uses any more; their ids are then handed
+// out again.
+class StringPool
+{
+public:
+    int intern(const QString &str);
+    const QString &string(int id) const { return strings.at(id); }
+    int count() const { return strings.size(); }
+    void prune(const QBitArray &used);
+    void clear();
+
+private:
+    QVector<QString> strings;
+    QHash<QString, int> ids;
+    QVector<int> freeIds;
+};
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,223 @@
+#include "undojournal.h"
+#include "sheet.h"
+
+#include <limits.h>
+
+UndoJournal::UndoJournal()
+    : limit(DefaultMemoryLimit), usage(0), groupDepth(0)
+{
+}
+
+void UndoJournal::setMemoryLimit(qint64 bytes)
+{
+    limit = qMax(Q_INT64_C(0), bytes);
+    trim();
+}
+
+// Edits recorded between beginGroup() and the matching endGroup() are
+// undone and redone as one.
+void UndoJournal::beginGroup()
+{
+    if (groupDepth++ > 0)
+        return;
+
+    CellRange none = { INT_MAX, INT_MAX, -1, -1 };
+    group = Entry();
+    group.range = none;
+    group.bytes = 0;
+    groupKeys.clear();
+}
+
+// Saves a cell as it is before the group changes it.  Only the first
+// recording of a cell in a group counts.
+void UndoJournal::record(const Sheet &sheet, int row, int column)
+{
+    if (groupDepth == 0)
+        return;
+
+    quint64 key = DependencyGraph::key(row, column);
+    if (groupKeys.contains(key))
+        return;
+    groupKeys.insert(key);
+
+    group.before.append(change(sheet, row, column));
+    group.range.top = qMin(group.range.top, row);
+    group.range.left = qMin(group.range.left, column);
+    group.range.bottom = qMax(group.range.bottom, row);
+    group.range.right = qMax(group.range.right, column);
+}
+
+void UndoJournal::record(const Sheet &sheet, const CellRange &range)
+{
+    for (int column = range.left; column <= range.right; ++column) {
+        for (int row = range.top; row <= range.bottom; ++row)
+            record(sheet, row, column);
+    }
+}
+
+void UndoJournal::endGroup(const Sheet &sheet, const QString &text)
+{
+    if (groupDepth == 0 || --groupDepth > 0)
+        return;
+
+    Entry entry = group;
+    group = Entry();
+    groupKeys.clear();
+    if (entry.before.isEmpty())
+        return;
+
+    entry.text = text;
+    entry.after.reserve(entry.before.size());
+    foreach (const Change &old, entry.before)
+        entry.after.append(change(sheet, old.row, old.column));
+    entry.bytes = cost(entry.before) + cost(entry.after);
+    push(entry);
+}
+
+// Called before a sort is applied.  Redoing it is sorting again; to
+// undo it the inverse permutation is applied and the formulas of the
+// moved rows are put back, because rewriting their references is not
+// always reversible.
+void UndoJournal::recordPermutation(const Sheet &sheet,
+                                    const CellRange &range,
+                                    const QVector<int> &order,
+                                    const QString &text)
+{
+    Entry entry;
+    entry.text = text;
+    entry.range = range;
+    entry.order = order;
+
+    for (int i = 0; i < order.size(); ++i) {
+        if (order[i] == i)
+            continue;
+        for (int column = range.left; column <= range.right; ++column) {
+            const Cell *cell = sheet.cells().cell(range.top + i, column);
+            if (cell && cell->hasFormula())
+                entry.before.append(change(sheet, range.top + i, column));
+        }
+    }
+    entry.bytes = order.size() * qint64(sizeof(int)) + cost(entry.before);
+    push(entry);
+}
+
+QString UndoJournal::undoText() const
+{
+    return undoEntries.isEmpty() ? QString() : undoEntries.last().text;
+}
+
+QString UndoJournal::redoText() const
+{
+    return redoEntries.isEmpty() ? QString() : redoEntries.last().text;
+}
+
+// Undoes the latest entry as one batch of edits, so that only the
+// cells it touches and their dependents are recalculated.  Returns the
+// range of cells that changed.
+CellRange UndoJournal::undo(Sheet *sheet)
+{
+    CellRange none = { 0, 0, -1, -1 };
+    if (undoEntries.isEmpty())
+        return none;
+
+    Entry entry = undoEntries.takeLast();
+    sheet->beginBatch();
+    if (!entry.order.isEmpty()) {
+        QVector<int> inverse(entry.order.size());
+        for (int i = 0; i < entry.order.size(); ++i)
+            inverse[entry.order[i]] = i;
+        sheet->permuteRows(entry.range, inverse);
+    }
+    apply(sheet, entry.before);
+    sheet->commitBatch();
+
+    redoEntries.append(entry);
+    return entry.range;
+}
+
+CellRange UndoJournal::redo(Sheet *sheet)
+{
+    CellRange none = { 0, 0, -1, -1 };
+    if (redoEntries.isEmpty())
+        return none;
+
+    Entry entry = redoEntries.takeLast();
+    sheet->beginBatch();
+    if (!entry.order.isEmpty())
+        sheet->permuteRows(entry.range, entry.order);
+    apply(sheet, entry.after);
+    sheet->commitBatch();
+
+    undoEntries.append(entry);
+    return entry.range;
+}
+
+// Marks the strings of the saved cells, which undo and redo put back.
+void UndoJournal::markStrings(QBitArray *used) const
+{
+    QVector<Entry> entries = undoEntries + redoEntries;
+    if (groupDepth > 0)
+        entries.append(group);
+
+    foreach (const Entry &entry, entries) {
+        foreach (const Change &change, entry.before)
+            change.cell.markStrings(used);
+        foreach (const Change &change, entry.after)
+            change.cell.markStrings(used);
+    }
+}
+
+void UndoJournal::clear()
+{
+    undoEntries.clear();
+    redoEntries.clear();
+    usage = 0;
+}
+
+UndoJournal::Change UndoJournal::change(const Sheet &sheet, int row,
+                                        int column)
+{
+    const Cell *cell = sheet.cells().cell(row, column);
+    Change result = { row, column, cell != 0, cell ? *cell : Cell() };
+    return result;
+}
+
+// An estimate: programs and texts are shared with the sheet and not
+// counted.
+qint64 UndoJournal::cost(const QVector<Change> &changes)
+{
+    return changes.size() * qint64(sizeof(Change));
+}
+
+void UndoJournal::apply(Sheet *sheet, const QVector<Change> &changes)
+{
+    foreach (const Change &change, changes)
+        sheet->putCell(change.row, change.column,
+                       change.exists ? &change.cell : 0);
+}
+
+// A new entry makes the redo stack obsolete.
+void UndoJournal::push(const Entry &entry)
+{
+    foreach (const Entry &obsolete, redoEntries)
+        usage -= obsolete.bytes;
+    redoEntries.clear();
+
+    undoEntries.append(entry);
+    usage += entry.bytes;
+    trim();
+}
+
+// Drops the oldest undo entries first, then the redo entries furthest
+// from the current state.
+void UndoJournal::trim()
+{
+    while (usage > limit && !undoEntries.isEmpty()) {
+        usage -= undoEntries.first().bytes;
+        undoEntries.removeFirst();
+    }
+    while (usage > limit && !redoEntries.isEmpty()) {
+        usage -= redoEntries.first().bytes;
+        redoEntries.removeFirst();
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef UNDOJOURNAL_H
+#define UNDOJOURNAL_H
+
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "cell.h"
+#include "cellreference.h"
+
+class Sheet;
+
+// Records edits as compact deltas so that they can be undone and
+// redone.  An entry holds copies of the cells an operation replaced and
+// of what replaced them; cell copies share their compiled program and
+// text with the sheet, so an entry costs little more than its cell
+// count.  A sort is kept as its permutation plus the formulas of the
+// moved rows, whose references the sort rewrote.
+//
+// Entries are dropped oldest first once the journal outgrows its
+// memory limit.
+class UndoJournal
+{
+public:
+    enum { DefaultMemoryLimit = 256 * 1024 * 1024 };
+
+    UndoJournal();
+
+    qint64 memoryLimit() const { return limit; }
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryUsage() const { return usage; }
+
+    void beginGroup();
+    void record(const Sheet &sheet, int row, int column);
+    void record(const Sheet &sheet, const CellRange &range);
+    void endGroup(const Sheet &sheet, const QString &text);
+    bool inGroup() const { return groupDepth > 0; }
+    void recordPermutation(const Sheet &sheet, const CellRange &range,
+                           const QVector<int> &order, const QString &text);
+
+    bool canUndo() const { return !undoEntries.isEmpty(); }
+    bool canRedo() const { return !redoEntries.isEmpty(); }
+    QString undoText() const;
+    QString redoText() const;
+    CellRange undo(Sheet *sheet);
+    CellRange redo(Sheet *sheet);
+    void markStrings(QBitArray *used) const;
+    void clear();
+
+private:
+    struct Change
+    {
+        int row;
+        int column;
+        bool exists;
+        Cell cell;
+    };
+
+    struct Entry
+    {
+        QString text;
+        CellRange range;
+        QVector<int> order;
+        QVector<Change> before;
+        QVector<Change> after;
+        qint64 bytes;
+    };
+
+    static Change change(const Sheet &sheet, int row, int column);
+    static qint64 cost(const QVector<Change> &changes);
+    static void apply(Sheet *sheet, const QVector<Change> &changes);
+    void push(const Entry &entry);
+    void trim();
+
+    QVector<Entry> undoEntries;
+    QVector<Entry> redoEntries;
+    qint64 limit;
+    qint64 usage;
+
+    int groupDepth;
+    Entry group;
+    QSet<quint64> groupKeys;
+};
+
+#endif // UNDOJOURNAL_H
@@ -0,0 +1,39 @@
+#include "value.h"
+
+bool Value::operator==(const Value &other) const
+{
+    if (kind != other.kind)
+        return false;
+
+    switch (kind) {
+    case Number:
+        return data.number == other.data.number;
+    case String:
+    case Error:
+        return data.id == other.data.id;
+    case Boolean:
+        return data.boolean == other.data.boolean;
+    default:
+        return true;
+    }
+}
+
+QString Value::errorText(ErrorCode code)
+{
+    switch (code) {
+    case DivideByZero:
+        return "#DIV/0!";
+    case BadReference:
+        return "#REF!";
+    case Cycle:
+        return "#CYCLE!";
+    case ParseError:
+        return "#PARSE!";
+    case WrongType:
+        return "#VALUE!";
+    case NotAvailable:
+        return "#N/A";
+    default:
+        return QString();
+    }
+}
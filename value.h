@@ -0,0 +1,79 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <QString>
+#include <QtGlobal>
+
+// A cell value as the engine sees it: a small tagged union that is
+// copied by value and never allocates.  Strings are ids into the
+// sheet's StringPool; conversion to QVariant happens only in the model.
+class Value
+{
+public:
+    enum Type { Empty, Number, String, Boolean, Error };
+    enum ErrorCode { NoError, DivideByZero, BadReference, Cycle,
+                     ParseError, WrongType, NotAvailable };
+
+    Value() : kind(Empty) { data.number = 0.0; }
+
+    static Value fromNumber(double number)
+        { Value v(Number); v.data.number = number; return v; }
+    static Value fromString(int id)
+        { Value v(String); v.data.id = id; return v; }
+    static Value fromBool(bool boolean)
+        { Value v(Boolean); v.data.boolean = boolean; return v; }
+    static Value fromError(ErrorCode code)
+        { Value v(Error); v.data.id = code; return v; }
+
+    Type type() const { return Type(kind); }
+    bool isEmpty() const { return kind == Empty; }
+    bool isNumber() const { return kind == Number; }
+    bool isString() const { return kind == String; }
+    bool isBool() const { return kind == Boolean; }
+    bool isError() const { return kind == Error; }
+
+    double toNumber() const { return data.number; }
+    int stringId() const { return data.id; }
+    bool toBool() const { return data.boolean; }
+    ErrorCode errorCode() const { return ErrorCode(data.id); }
+
+    // Converts for arithmetic the way spreadsheets do: booleans count
+    // as 1 and 0, empty as 0, and strings are not numbers.
+    bool toNumber(double *number) const;
+
+    bool operator==(const Value &other) const;
+    bool operator!=(const Value &other) const { return !(*this == other); }
+
+    static QString errorText(ErrorCode code);
+
+private:
+    explicit Value(Type type) : kind(type) {}
+
+    quint8 kind;
+    union {
+        double number;
+        int id;
+        bool boolean;
+    } data;
+};
+
+Q_DECLARE_TYPEINFO(Value, Q_PRIMITIVE_TYPE);
+
+inline bool Value::toNumber(double *number) const
+{
+    switch (kind) {
+    case Number:
+        *number = data.number;
+        return true;
+    case Boolean:
+        *number = data.boolean ? 1.0 : 0.0;
+        return true;
+    case Empty:
+        *number = 0.0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+#endif // VALUE_H